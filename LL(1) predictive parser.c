@@ -1,535 +1,6220 @@
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LL1_X86_SIMD
+#include <immintrin.h>
+#endif
 
-// Maximum limits for various components
-#define MAX_RULES 10          // Maximum number of production rules
-#define MAX_SYMBOLS 10        // Maximum symbols in a production
-#define MAX_TERMINALS 10      // Maximum terminal symbols
-#define MAX_NONTERMINALS 10   // Maximum non-terminal symbols
-#define MAX_INPUT 100         // Maximum input
+#include "ll1_parser.h"
 
-// Structure to represent a production rule
-typedef struct {
-    char lhs;                   // Left-hand side non-terminal
-    char rhs[MAX_SYMBOLS][MAX_SYMBOLS];  // Right-hand side productions (multiple alternatives)
-    int rhs_count;              // Number of productions for this non-terminal
-} ProductionRule;
+#define INPUT_CHUNK 65536             // Bytes read from a file per refill
+#define BATCH_CHUNK (1 << 20)         // Target bytes per batch validation task
+#define PARALLEL_SET_WORK (1 << 16)   // Set-word operations for a FIRST/FOLLOW level to be threaded
+#define PACK_MIN_BYTES (1 << 16)      // Smallest dense parsing table considered for packing
+#define PACK_MAX_DENSITY 8            // Pack only when at most 1 in this many cells is filled
+#define PACK_MAX_PROBES 4096          // First-fit candidates tried per row before placing it past the end
+#define CHECKPOINT_SPACING 256        // Input bytes between incremental parse checkpoints
+#define PARALLEL_SEGMENT (1 << 20)    // Smallest share of an input per thread worth a parallel parse
 
-// Structure to store FIRST and FOLLOW sets for non-terminals
-typedef struct {
-    char non_terminal;          // The non-terminal symbol
-    char first[MAX_TERMINALS];  // FIRST set for this non-terminal
-    int first_count;            // Number of elements in FIRST set
-    char follow[MAX_TERMINALS]; // FOLLOW set for this non-terminal
-    int follow_count;           // Number of elements in FOLLOW set
-} FirstFollow;
+// Forces a function to be inlined, so constant arguments specialize it
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
 
-// Global variables
-ProductionRule rules[MAX_RULES];                // Array to store all production rules
-FirstFollow firstFollow[MAX_NONTERMINALS];     // Array to store FIRST and FOLLOW sets
-char terminals[MAX_TERMINALS] = {'i', '(', ')', '*', '+', '$'};  // Terminal symbols
-char non_terminals[MAX_NONTERMINALS] = {'E', 'X', 'T', 'Y', 'F'}; // Non-terminal symbols
-int terminal_count = 6;                         // Number of terminal symbols
-int non_terminal_count = 5;                     // Number of non-terminal symbols
-int rule_count = 0;                             // Current number of rules
+// Function to grow an array so it can hold at least `needed` elements
+static void *grow_array(void *array, int *capacity, int needed, size_t elem_size) {
+    if (needed <= *capacity) return array;
+    int new_capacity = *capacity ? *capacity : 8;
+    while (new_capacity < needed) new_capacity *= 2;
+    array = realloc(array, (size_t)new_capacity * elem_size);
+    if (!array) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return array;
+}
 
-// Parsing table: non-terminals x terminals -> production to apply
-char parsing_table[MAX_NONTERMINALS][MAX_TERMINALS][MAX_SYMBOLS];
+// Stack implementation for parsing; each context owns its stack, which grows
+// on demand, so its size follows the nesting depth of the input
+static void push(ParseContext *ctx, Symbol s) {
+    if (ctx->top + 1 >= ctx->stack_capacity) {
+        ctx->stack = grow_array(ctx->stack, &ctx->stack_capacity, ctx->top + 2, sizeof(Symbol));
+    }
+    ctx->stack[++ctx->top] = s;
+}
 
-// Stack implementation for parsing
-char stack[MAX_INPUT * 2];
-int top = -1;
+static Symbol pop(ParseContext *ctx) {
+    if (ctx->top >= 0) {
+        return ctx->stack[ctx->top--];
+    }
+    return 0;
+}
 
-void push(char c) {
-    if (top < MAX_INPUT * 2 - 1) {
-        stack[++top] = c;
+static Symbol peek(const ParseContext *ctx) {
+    if (ctx->top >= 0) {
+        return ctx->stack[ctx->top];
     }
+    return 0;
 }
 
-char pop() {
-    if (top >= 0) {
-        return stack[top--];
+// FNV-1a hash of a symbol name
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 16777619u;
     }
-    return '\0';
+    return h;
 }
 
-char peek() {
-    if (top >= 0) {
-        return stack[top];
+// Function to get the ID of a name in a symbol table, or -1 if it is not there
+static int find_symbol(const SymbolTable *table, const char *name) {
+    if (table->slot_count == 0) return -1;
+    uint32_t mask = table->slot_count - 1;
+    for (uint32_t i = hash_name(name) & mask; table->slots[i]; i = (i + 1) & mask) {
+        int id = table->slots[i] - 1;
+        if (strcmp(table->names[id], name) == 0) return id;
     }
-    return '\0';
+    return -1;
 }
 
-// Function to check if a character is a terminal
-int is_terminal(char c) {
-    for (int i = 0; i < terminal_count; i++) {
-        if (terminals[i] == c) return 1;
+// Function to return the ID of a name, adding it to the table if needed
+static int intern_symbol(SymbolTable *table, const char *name) {
+    int id = find_symbol(table, name);
+    if (id >= 0) return id;
+
+    // Keep the hash index at most half full
+    if ((table->count + 1) * 2 > table->slot_count) {
+        int slot_count = table->slot_count ? table->slot_count * 2 : 16;
+        free(table->slots);
+        table->slots = calloc(slot_count, sizeof(int));
+        table->slot_count = slot_count;
+        for (int i = 0; i < table->count; i++) {
+            uint32_t j = hash_name(table->names[i]) & (slot_count - 1);
+            while (table->slots[j]) j = (j + 1) & (slot_count - 1);
+            table->slots[j] = i + 1;
+        }
     }
-    return 0;
+
+    table->names = grow_array(table->names, &table->capacity, table->count + 1, sizeof(char *));
+    id = table->count++;
+    table->names[id] = strdup(name);
+
+    uint32_t j = hash_name(name) & (table->slot_count - 1);
+    while (table->slots[j]) j = (j + 1) & (table->slot_count - 1);
+    table->slots[j] = id + 1;
+    return id;
+}
+
+static void free_symbol_table(SymbolTable *table) {
+    for (int i = 0; i < table->count; i++) free(table->names[i]);
+    free(table->names);
+    free(table->slots);
+    memset(table, 0, sizeof(*table));
+}
+
+// Function to check if a symbol is a terminal
+static bool is_terminal(Symbol s) {
+    return s >= 0;
+}
+
+// Function to get the terminal ID of an input character (-1 if not a terminal)
+int get_terminal_index(const Grammar *g, char c) {
+    return g->terminal_of_byte[(unsigned char)c];
+}
+
+// Function to get the index of a non-terminal by name (-1 if not found)
+int get_non_terminal_index(const Grammar *g, const char *name) {
+    return find_symbol(&g->non_terminals, name);
+}
+
+// Function to get the printable name of a symbol
+const char *symbol_name(const Grammar *g, Symbol s) {
+    return is_terminal(s) ? g->terminals.names[s] : g->non_terminals.names[NT_INDEX(s)];
 }
 
-// Function to check if a character is a non-terminal
-int is_non_terminal(char c) {
-    for (int i = 0; i < non_terminal_count; i++) {
-        if (non_terminals[i] == c) return 1;
+// Function to add a terminal; single-byte names are also mapped for the input scanner
+int add_terminal(Grammar *g, const char *name) {
+    int id = intern_symbol(&g->terminals, name);
+    if (name[0] != '\0' && name[1] == '\0') {
+        g->terminal_of_byte[(unsigned char)name[0]] = id;
     }
-    return 0;
+    if (strcmp(name, "$") == 0) g->end_marker = id;
+    return id;
+}
+
+// Function to add a non-terminal
+int add_non_terminal(Grammar *g, const char *name) {
+    return intern_symbol(&g->non_terminals, name);
+}
+
+// Profiling counters, compiled in with -DLL1_PROFILE. Each thread counts into
+// its own ParseProfile per grammar, so the hot path takes no lock and shares
+// no cache lines; profile_write_json merges every thread's counters. Without
+// LL1_PROFILE the parse loop is given a NULL profile and the counting code is
+// removed along with it.
+enum {
+    PROFILE_FIRST,
+    PROFILE_FOLLOW,
+    PROFILE_TABLE,
+    PROFILE_PHASES
+};
+
+#define STEP_BUCKETS 33         // Inputs by steps taken: 0-1, 2-3, 4-7, ... 2^32-
+
+typedef struct ParseProfile {
+    _Atomic(const Grammar *) grammar;   // NULL once the grammar is freed, until the thread reuses the block
+    uint64_t *cell_hits;                // Expansions through each parsing table cell
+    uint64_t *terminal_matches;         // Matches of each terminal
+    int non_terminal_count;             // Table shape the counters are sized for
+    int terminal_count;
+    uint64_t inputs;
+    uint64_t accepted;
+    uint64_t steps;
+    uint64_t max_steps;
+    uint64_t step_histogram[STEP_BUCKETS];
+    int max_depth;                      // Stack depth high-water mark
+    double parse_seconds;
+    double phase_seconds[PROFILE_PHASES];
+    uint64_t phase_calls[PROFILE_PHASES];
+    struct ParseProfile *next;          // Next profile of any thread
+    struct ParseProfile *thread_next;   // Next profile of the same thread
+    bool orphaned;                      // Its thread has exited; freed once detached
+} ParseProfile;
+
+#ifdef LL1_PROFILE
+
+static ParseProfile *all_profiles;
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Thread_local ParseProfile *thread_profiles;
+static _Thread_local ParseProfile *current_profile;
+static pthread_once_t profile_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t profile_key;           // Orphans a thread's profiles when it exits
+
+// Function to unlink and free the detached profiles of exited threads. Call
+// it with profile_lock held.
+static void free_orphaned_profiles(void) {
+    ParseProfile **link = &all_profiles;
+    while (*link) {
+        ParseProfile *profile = *link;
+        if (profile->orphaned && !profile->grammar) {
+            *link = profile->next;
+            free(profile);
+        } else {
+            link = &profile->next;
+        }
+    }
+}
+
+static void orphan_thread_profiles(void *unused) {
+    (void)unused;
+    pthread_mutex_lock(&profile_lock);
+    for (ParseProfile *profile = thread_profiles; profile; profile = profile->thread_next) profile->orphaned = true;
+    free_orphaned_profiles();
+    pthread_mutex_unlock(&profile_lock);
+    thread_profiles = current_profile = NULL;
+}
+
+static void create_profile_key(void) {
+    pthread_key_create(&profile_key, orphan_thread_profiles);
+}
+
+static double profile_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to check that a profile's counters are sized for a grammar's table
+static bool profile_fits(const ParseProfile *profile, const Grammar *g) {
+    return profile->non_terminal_count == g->non_terminals.count && profile->terminal_count == g->terminals.count;
+}
+
+// Function to detach a profile from its grammar and free its counters. Call
+// it with profile_lock held.
+static void detach_profile(ParseProfile *profile) {
+    profile->grammar = NULL;
+    free(profile->cell_hits);
+    free(profile->terminal_matches);
+    profile->cell_hits = NULL;
+    profile->terminal_matches = NULL;
 }
 
-// Function to get the index of a terminal in the terminals array
-int get_terminal_index(char c) {
-    for (int i = 0; i < terminal_count; i++) {
-        if (terminals[i] == c) return i;
+// Function to get the calling thread's counters for a grammar, creating them
+// on first use. The last one used is cached, so a parse usually finds it at once.
+// A block of this thread whose grammar was freed is reused before allocating
+// another, so reloading a grammar does not grow the list.
+static ParseProfile *thread_profile(const Grammar *g) {
+    ParseProfile *profile = current_profile;
+    if (profile && profile->grammar == g && profile_fits(profile, g)) return profile;
+    ParseProfile *spare = NULL;
+    for (profile = thread_profiles; profile; profile = profile->thread_next) {
+        const Grammar *owner = profile->grammar;
+        if (owner == g && profile_fits(profile, g)) return current_profile = profile;
+        if (owner == g) {
+            // Left by an earlier grammar at the same address that was never freed
+            pthread_mutex_lock(&profile_lock);
+            detach_profile(profile);
+            pthread_mutex_unlock(&profile_lock);
+            owner = NULL;
+        }
+        if (!owner && !spare) spare = profile;
+    }
+
+    // Sized for the whole table, but calloc'd pages are only backed once touched
+    uint64_t *cell_hits = calloc((size_t)g->non_terminals.count * g->terminals.count + 1, sizeof(uint64_t));
+    uint64_t *terminal_matches = calloc(g->terminals.count + 1, sizeof(uint64_t));
+    if (!thread_profiles) {
+        pthread_once(&profile_key_once, create_profile_key);
+        pthread_setspecific(profile_key, &thread_profiles);
+    }
+    pthread_mutex_lock(&profile_lock);
+    if (spare) {
+        // Only this thread attaches a detached block, so it is still detached
+        profile = spare;
+        memset(&profile->inputs, 0, offsetof(ParseProfile, next) - offsetof(ParseProfile, inputs));
+    } else {
+        profile = calloc(1, sizeof(ParseProfile));
+        profile->thread_next = thread_profiles;
+        thread_profiles = profile;
+        profile->next = all_profiles;
+        all_profiles = profile;
     }
-    return -1;  // Return -1 if not found
+    profile->cell_hits = cell_hits;
+    profile->terminal_matches = terminal_matches;
+    profile->non_terminal_count = g->non_terminals.count;
+    profile->terminal_count = g->terminals.count;
+    profile->grammar = g;
+    pthread_mutex_unlock(&profile_lock);
+    return current_profile = profile;
 }
 
-// Function to get the index of a non-terminal in the non_terminals array
-int get_non_terminal_index(char c) {
-    for (int i = 0; i < non_terminal_count; i++) {
-        if (non_terminals[i] == c) return i;
+// Function to record one parsed input
+static void profile_input(ParseProfile *profile, bool accepted, uint64_t steps, double seconds) {
+    int bucket = steps > 1 ? 64 - __builtin_clzll(steps) - 1 : 0;
+    profile->inputs++;
+    profile->accepted += accepted;
+    profile->step_histogram[bucket < STEP_BUCKETS ? bucket : STEP_BUCKETS - 1]++;
+    if (steps > profile->max_steps) profile->max_steps = steps;
+    profile->parse_seconds += seconds;
+}
+
+#define PROFILE_PHASE_BEGIN() double phase_started = profile_clock()
+#define PROFILE_PHASE_END(g, phase) do { \
+        ParseProfile *phase_profile = thread_profile(g); \
+        phase_profile->phase_seconds[phase] += profile_clock() - phase_started; \
+        phase_profile->phase_calls[phase]++; \
+    } while (0)
+
+// Function to detach a grammar's counters when it is freed, so a grammar
+// later allocated at the same address starts from zero. The counter arrays
+// are freed at once; a block stays on its thread's list for reuse, unless
+// the thread has exited.
+static void profile_forget(const Grammar *g) {
+    pthread_mutex_lock(&profile_lock);
+    for (ParseProfile *profile = all_profiles; profile; profile = profile->next) {
+        if (profile->grammar == g) detach_profile(profile);
     }
-    return -1;  // Return -1 if not found
+    free_orphaned_profiles();
+    pthread_mutex_unlock(&profile_lock);
 }
 
-// Function to add a symbol to the FIRST set of a non-terminal
-void add_to_first(int nt_index, char symbol) {
-    // Check if the symbol is already in the FIRST set
-    for (int i = 0; i < firstFollow[nt_index].first_count; i++) {
-        if (firstFollow[nt_index].first[i] == symbol) return;
+// Function to hand a grammar's counters to the grammar it was moved to, as
+// shared_grammar_publish moves the caller's grammar to the heap
+static void profile_move(const Grammar *from, const Grammar *to) {
+    pthread_mutex_lock(&profile_lock);
+    for (ParseProfile *profile = all_profiles; profile; profile = profile->next) {
+        if (profile->grammar == from) profile->grammar = to;
     }
-    // Add the symbol if not already present
-    firstFollow[nt_index].first[firstFollow[nt_index].first_count++] = symbol;
+    pthread_mutex_unlock(&profile_lock);
 }
 
-// Function to add a symbol to the FOLLOW set of a non-terminal
-void add_to_follow(int nt_index, char symbol) {
-    // Check if the symbol is already in the FOLLOW set
-    for (int i = 0; i < firstFollow[nt_index].follow_count; i++) {
-        if (firstFollow[nt_index].follow[i] == symbol) return;
+// Function to zero every thread's counters
+void profile_reset(void) {
+    pthread_mutex_lock(&profile_lock);
+    for (ParseProfile *profile = all_profiles; profile; profile = profile->next) {
+        if (!profile->grammar) continue;
+        memset(profile->cell_hits, 0, (size_t)profile->non_terminal_count * profile->terminal_count * sizeof(uint64_t));
+        memset(profile->terminal_matches, 0, profile->terminal_count * sizeof(uint64_t));
+        memset(&profile->inputs, 0, offsetof(ParseProfile, next) - offsetof(ParseProfile, inputs));
     }
-    // Add the symbol if not already present
-    firstFollow[nt_index].follow[firstFollow[nt_index].follow_count++] = symbol;
+    pthread_mutex_unlock(&profile_lock);
 }
 
-// Function to add a production rule to the grammar
-void add_rule(char lhs, char *rhs) {
-    rules[rule_count].lhs = lhs;            // Set left-hand side
-    strcpy(rules[rule_count].rhs[0], rhs);  // Set right-hand side
-    rules[rule_count].rhs_count = 1;        // Set production count
-    rule_count++;                           // Increment rule counter
+// Function to write a string as a JSON string literal
+static void write_json_string(FILE *out, const char *text) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(out, "\\%c", *p);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
 }
 
-// Function to check if a FIRST set contains epsilon ('e')
-bool contains_epsilon(char *first, int count) {
-    for (int i = 0; i < count; i++) {
-        if (first[i] == 'e') return true;
+// Function to merge every thread's counters for a grammar and write them as
+// one JSON object. Only cells, productions and terminals that were hit are
+// listed. Call it while no thread is parsing with the grammar.
+bool profile_write_json(const Grammar *g, FILE *out) {
+    size_t cells = (size_t)g->non_terminals.count * g->terminals.count;
+    uint64_t *cell_hits = calloc(cells + 1, sizeof(uint64_t));
+    uint64_t *terminal_matches = calloc(g->terminals.count + 1, sizeof(uint64_t));
+    uint64_t *production_hits = calloc(g->rule_count + 1, sizeof(uint64_t));
+    ParseProfile total = {0};
+    int threads = 0;
+    char production[256];
+
+    pthread_mutex_lock(&profile_lock);
+    for (ParseProfile *profile = all_profiles; profile; profile = profile->next) {
+        if (profile->grammar != g || !profile_fits(profile, g)) continue;
+        threads++;
+        for (size_t c = 0; c < cells; c++) cell_hits[c] += profile->cell_hits[c];
+        for (int t = 0; t < g->terminals.count; t++) terminal_matches[t] += profile->terminal_matches[t];
+        total.inputs += profile->inputs;
+        total.accepted += profile->accepted;
+        total.steps += profile->steps;
+        if (profile->max_steps > total.max_steps) total.max_steps = profile->max_steps;
+        for (int b = 0; b < STEP_BUCKETS; b++) total.step_histogram[b] += profile->step_histogram[b];
+        if (profile->max_depth > total.max_depth) total.max_depth = profile->max_depth;
+        total.parse_seconds += profile->parse_seconds;
+        for (int p = 0; p < PROFILE_PHASES; p++) {
+            total.phase_seconds[p] += profile->phase_seconds[p];
+            total.phase_calls[p] += profile->phase_calls[p];
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+
+    static const char *const phase_names[PROFILE_PHASES] = {"compute_first", "compute_follow", "create_parsing_table"};
+    fprintf(out, "{\n  \"threads\": %d,\n  \"phases\": {", threads);
+    for (int p = 0; p < PROFILE_PHASES; p++) {
+        fprintf(out, "%s\n    \"%s\": {\"calls\": %llu, \"us\": %.1f}", p ? "," : "", phase_names[p],
+                (unsigned long long)total.phase_calls[p], total.phase_seconds[p] * 1e6);
+    }
+    fprintf(out, "\n  },\n  \"parse\": {\"inputs\": %llu, \"accepted\": %llu, \"us\": %.1f, \"steps\": %llu, "
+                 "\"max_steps\": %llu, \"max_stack_depth\": %d,\n    \"steps_per_input\": [",
+            (unsigned long long)total.inputs, (unsigned long long)total.accepted, total.parse_seconds * 1e6,
+            (unsigned long long)total.steps, (unsigned long long)total.max_steps, total.max_depth);
+    bool first = true;
+    for (int b = 0; b < STEP_BUCKETS; b++) {
+        if (!total.step_histogram[b]) continue;
+        fprintf(out, "%s{\"min\": %llu, \"inputs\": %llu}", first ? "" : ", ",
+                b ? 1ULL << b : 0ULL, (unsigned long long)total.step_histogram[b]);
+        first = false;
+    }
+
+    fprintf(out, "]},\n  \"cells\": [");
+    first = true;
+    for (size_t c = 0; c < cells; c++) {
+        if (!cell_hits[c]) continue;
+        int entry = table_entry(g, c / g->terminals.count, c % g->terminals.count);
+        production_hits[entry] += cell_hits[c];
+        fprintf(out, "%s\n    {\"non_terminal\": ", first ? "" : ",");
+        write_json_string(out, g->non_terminals.names[c / g->terminals.count]);
+        fprintf(out, ", \"terminal\": ");
+        write_json_string(out, g->terminals.names[c % g->terminals.count]);
+        fprintf(out, ", \"production\": %d, \"hits\": %llu}", entry, (unsigned long long)cell_hits[c]);
+        first = false;
+    }
+
+    fprintf(out, "\n  ],\n  \"productions\": [");
+    first = true;
+    for (int r = 0; r < g->rule_count; r++) {
+        if (!production_hits[r]) continue;
+        format_production(g, &g->rules[r], production, sizeof(production));
+        fprintf(out, "%s\n    {\"production\": %d, \"non_terminal\": ", first ? "" : ",", r);
+        write_json_string(out, g->non_terminals.names[g->rules[r].lhs]);
+        fprintf(out, ", \"rhs\": ");
+        write_json_string(out, production);
+        fprintf(out, ", \"hits\": %llu}", (unsigned long long)production_hits[r]);
+        first = false;
+    }
+
+    fprintf(out, "\n  ],\n  \"terminals\": [");
+    first = true;
+    for (int t = 0; t < g->terminals.count; t++) {
+        if (!terminal_matches[t]) continue;
+        fprintf(out, "%s\n    {\"terminal\": ", first ? "" : ",");
+        write_json_string(out, g->terminals.names[t]);
+        fprintf(out, ", \"matches\": %llu}", (unsigned long long)terminal_matches[t]);
+        first = false;
     }
+    fprintf(out, "\n  ]\n}\n");
+
+    free(cell_hits);
+    free(terminal_matches);
+    free(production_hits);
+    return !ferror(out);
+}
+
+#else
+
+#define PROFILE_PHASE_BEGIN() ((void)0)
+#define PROFILE_PHASE_END(g, phase) ((void)0)
+
+void profile_reset(void) {}
+
+bool profile_write_json(const Grammar *g, FILE *out) {
+    (void)g;
+    (void)out;
     return false;
 }
 
-// Function to compute FIRST sets for all non-terminals
-void compute_first() {
-    bool changed;  // Flag to track if any FIRST set was modified
-    
-    // Initialize FIRST sets
-    for (int i = 0; i < non_terminal_count; i++) {
-        firstFollow[i].non_terminal = non_terminals[i];
-        firstFollow[i].first_count = 0;
+#endif // LL1_PROFILE
+
+// Function to set up an empty grammar
+void grammar_init(Grammar *g) {
+    memset(g, 0, sizeof(*g));
+    memset(g->terminal_of_byte, -1, sizeof(g->terminal_of_byte));
+    g->end_marker = -1;
+    g->literal_terminal = -1;
+    g->conflict_lhs = -1;
+    g->conflict_terminal = -1;
+}
+
+// Function to release the grammar and everything computed from it
+void free_grammar(Grammar *g) {
+#ifdef LL1_PROFILE
+    profile_forget(g);
+#endif
+    if (g->mapping) {
+        // Only the pointer arrays were allocated; everything else is in the mapping
+        free(g->terminals.names);
+        free(g->non_terminals.names);
+        free(g->firstFollow);
+        munmap(g->mapping, g->mapping_size);
+        grammar_init(g);
+        return;
     }
-    
-    // Iteratively compute FIRST sets until no changes occur
-    do {
-        changed = false;
-        for (int i = 0; i < rule_count; i++) {
-            char lhs = rules[i].lhs;
-            char *rhs = rules[i].rhs[0];
-            int lhs_index = get_non_terminal_index(lhs);
-            
-            // Case 1: First symbol of RHS is a terminal
-            if (is_terminal(rhs[0])) {
-                int old_count = firstFollow[lhs_index].first_count;
-                add_to_first(lhs_index, rhs[0]);
-                if (firstFollow[lhs_index].first_count > old_count) {
-                    changed = true;
-                }
-            }
-            // Case 2: First symbol of RHS is a non-terminal
-            else if (is_non_terminal(rhs[0])) {
-                int rhs_index = get_non_terminal_index(rhs[0]);
-                
-                // Add FIRST(rhs[0]) (excluding epsilon) to FIRST(lhs)
-                for (int j = 0; j < firstFollow[rhs_index].first_count; j++) {
-                    if (firstFollow[rhs_index].first[j] != 'e') {
-                        int old_count = firstFollow[lhs_index].first_count;
-                        add_to_first(lhs_index, firstFollow[rhs_index].first[j]);
-                        if (firstFollow[lhs_index].first_count > old_count) {
-                            changed = true;
-                        }
-                    }
-                }
-                
-                // Check if FIRST(rhs[0]) contains epsilon
-                bool has_epsilon = contains_epsilon(firstFollow[rhs_index].first, firstFollow[rhs_index].first_count);
-                
-                // If epsilon is present and there are more symbols in RHS
-                if (has_epsilon && strlen(rhs) > 1) {
-                    int pos = 1;
-                    // Process subsequent symbols until we find one without epsilon
-                    while (pos < strlen(rhs)) {
-                        if (is_terminal(rhs[pos])) {
-                            // If terminal, add to FIRST(lhs)
-                            int old_count = firstFollow[lhs_index].first_count;
-                            add_to_first(lhs_index, rhs[pos]);
-                            if (firstFollow[lhs_index].first_count > old_count) {
-                                changed = true;
-                            }
-                            break;
-                        }
-                        else {
-                            // If non-terminal, add its FIRST (excluding epsilon)
-                            int next_nt_index = get_non_terminal_index(rhs[pos]);
-                            for (int j = 0; j < firstFollow[next_nt_index].first_count; j++) {
-                                if (firstFollow[next_nt_index].first[j] != 'e') {
-                                    int old_count = firstFollow[lhs_index].first_count;
-                                    add_to_first(lhs_index, firstFollow[next_nt_index].first[j]);
-                                    if (firstFollow[lhs_index].first_count > old_count) {
-                                        changed = true;
-                                    }
-                                }
-                            }
-                            
-                            // Check if this non-terminal has epsilon
-                            has_epsilon = contains_epsilon(firstFollow[next_nt_index].first, firstFollow[next_nt_index].first_count);
-                            if (!has_epsilon) break;
-                            pos++;
-                        }
-                    }
-                    
-                    // If all symbols in RHS can derive epsilon, add epsilon to FIRST(lhs)
-                    if (pos == strlen(rhs)) {
-                        int old_count = firstFollow[lhs_index].first_count;
-                        add_to_first(lhs_index, 'e');
-                        if (firstFollow[lhs_index].first_count > old_count) {
-                            changed = true;
-                        }
-                    }
-                }
-            }
-            // Case 3: RHS is epsilon
-            else if (rhs[0] == 'e') {
-                int old_count = firstFollow[lhs_index].first_count;
-                add_to_first(lhs_index, 'e');
-                if (firstFollow[lhs_index].first_count > old_count) {
-                    changed = true;
-                }
-            }
-        }
-    } while (changed);  // Continue until no changes in any FIRST set
+    free(g->rules);
+    free(g->rhs_arena);
+    free(g->firstFollow);
+    free(g->set_storage);
+    free(g->parsing_table);
+    free(g->row_base);
+    free(g->packed_cells);
+    free(g->chain_index);
+    free(g->chain_arena);
+    free_symbol_table(&g->terminals);
+    free_symbol_table(&g->non_terminals);
+    grammar_init(g);
+}
+
+// Function to get the reversed right-hand side of a production
+const Symbol *rule_rhs(const Grammar *g, const ProductionRule *rule) {
+    return g->rhs_arena + rule->rhs_start;
+}
+
+// Function to check if a symbol is a semantic action
+static bool is_action(Symbol s) {
+    return s >= ACTION_BASE;
 }
 
-// Function to compute FOLLOW sets for all non-terminals
-void compute_follow() {
-    bool changed;  // Flag to track if any FOLLOW set was modified
-    
-    // Initialize FOLLOW sets
-    for (int i = 0; i < non_terminal_count; i++) {
-        firstFollow[i].follow_count = 0;
+// Names of the semantic actions, as written in grammar files ("{add}")
+static const char *const action_names[ACTION_COUNT] = {"add", "sub", "mul", "div", "mod", "neg"};
+
+// Function to get the action written as "{name}", or -1 if there is none
+static int find_action(const char *token) {
+    size_t len = strlen(token);
+    if (len < 3 || token[0] != '{' || token[len - 1] != '}') return -1;
+    for (int a = 0; a < ACTION_COUNT; a++) {
+        if (strlen(action_names[a]) == len - 2 && strncmp(token + 1, action_names[a], len - 2) == 0) return a;
     }
-    
-    // Rule 1: $ is in FOLLOW(S) where S is the start symbol
-    int start_index = get_non_terminal_index('E');
-    add_to_follow(start_index, '$');
-    
-    // Iteratively compute FOLLOW sets until no changes occur
-    do {
-        changed = false;
-        for (int i = 0; i < rule_count; i++) {
-            char lhs = rules[i].lhs;
-            char *rhs = rules[i].rhs[0];
-            int lhs_index = get_non_terminal_index(lhs);
-            
-            // Process each symbol in the RHS
-            for (int j = 0; j < strlen(rhs); j++) {
-                if (is_non_terminal(rhs[j])) {
-                    int nt_index = get_non_terminal_index(rhs[j]);
-                    
-                    // Case 1: A → αBβ (β is not ε)
-                    if (j < strlen(rhs) - 1) {
-                        char next = rhs[j+1];
-                        
-                        // Subcase 1: β is a terminal
-                        if (is_terminal(next)) {
-                            int old_count = firstFollow[nt_index].follow_count;
-                            add_to_follow(nt_index, next);
-                            if (firstFollow[nt_index].follow_count > old_count) {
-                                changed = true;
-                            }
-                        }
-                        // Subcase 2: β is a non-terminal
-                        else if (is_non_terminal(next)) {
-                            int next_index = get_non_terminal_index(next);
-                            
-                            // Add FIRST(β) (excluding ε) to FOLLOW(B)
-                            for (int k = 0; k < firstFollow[next_index].first_count; k++) {
-                                if (firstFollow[next_index].first[k] != 'e') {
-                                    int old_count = firstFollow[nt_index].follow_count;
-                                    add_to_follow(nt_index, firstFollow[next_index].first[k]);
-                                    if (firstFollow[nt_index].follow_count > old_count) {
-                                        changed = true;
-                                    }
-                                }
-                            }
-                            
-                            // If FIRST(β) contains ε, add FOLLOW(A) to FOLLOW(B)
-                            if (contains_epsilon(firstFollow[next_index].first, firstFollow[next_index].first_count)) {
-                                for (int k = 0; k < firstFollow[lhs_index].follow_count; k++) {
-                                    int old_count = firstFollow[nt_index].follow_count;
-                                    add_to_follow(nt_index, firstFollow[lhs_index].follow[k]);
-                                    if (firstFollow[nt_index].follow_count > old_count) {
-                                        changed = true;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    
-                    // Case 2: A → αB or A → αBβ where FIRST(β) contains ε
-                    if (j == strlen(rhs) - 1 || 
-                        (j < strlen(rhs) - 1 && is_non_terminal(rhs[j+1]) && 
-                         contains_epsilon(firstFollow[get_non_terminal_index(rhs[j+1])].first, 
-                                        firstFollow[get_non_terminal_index(rhs[j+1])].first_count))) {
-                        // Add FOLLOW(A) to FOLLOW(B)
-                        for (int k = 0; k < firstFollow[lhs_index].follow_count; k++) {
-                            int old_count = firstFollow[nt_index].follow_count;
-                            add_to_follow(nt_index, firstFollow[lhs_index].follow[k]);
-                            if (firstFollow[nt_index].follow_count > old_count) {
-                                changed = true;
-                            }
-                        }
-                    }
-                }
+    return -1;
+}
+
+// Function to add a production rule given as symbol IDs (in grammar order),
+// optionally with ACTION_SYMBOLs among them. The actions are left out of the
+// span used to build the table and only kept in the evaluator's span.
+// Returns false if the table's production index type is exhausted.
+bool add_rule_symbols(Grammar *g, int lhs, const Symbol *rhs, int rhs_len) {
+    if (g->rule_count >= NO_PRODUCTION) {
+        fprintf(stderr, "Error: More than %d productions\n", NO_PRODUCTION - 1);
+        return false;
+    }
+    int actions = 0;
+    for (int i = 0; i < rhs_len; i++) actions += is_action(rhs[i]);
+    g->rules = grow_array(g->rules, &g->rule_capacity, g->rule_count + 1, sizeof(ProductionRule));
+    g->rhs_arena = grow_array(g->rhs_arena, &g->arena_capacity,
+                              g->arena_count + rhs_len - actions + (actions ? rhs_len : 0), sizeof(Symbol));
+
+    ProductionRule *rule = &g->rules[g->rule_count];
+    rule->lhs = lhs;                                    // Set left-hand side
+    rule->rhs_start = g->arena_count;                   // Set right-hand side, reversed
+    rule->rhs_len = rhs_len - actions;
+    for (int i = rhs_len - 1; i >= 0; i--) {
+        if (!is_action(rhs[i])) g->rhs_arena[g->arena_count++] = rhs[i];
+    }
+    rule->eval_start = rule->rhs_start;                 // Same span again, with the actions
+    rule->eval_len = rhs_len;
+    if (actions) {
+        rule->eval_start = g->arena_count;
+        for (int i = rhs_len - 1; i >= 0; i--) {
+            g->rhs_arena[g->arena_count++] = rhs[i];
+        }
+    }
+    g->rule_count++;                                    // Increment rule counter
+    return true;
+}
+
+// Function to make runs of decimal digits in the input read as one terminal,
+// whose value the evaluator pushes (the "i" of the expression grammar)
+void set_literal_terminal(Grammar *g, int terminal) {
+    for (int c = '0'; c <= '9'; c++) g->terminal_of_byte[c] = terminal;
+    g->literal_terminal = terminal;
+}
+
+// Function to add a production rule written with single-character symbols,
+// e.g. add_rule(g, 'X', "+T{add}X"). Declared non-terminals are looked up,
+// 'e' is epsilon, "{name}" is a semantic action and any other character is a
+// terminal.
+void add_rule(Grammar *g, char lhs, const char *rhs) {
+    char name[2] = {lhs, '\0'};
+    int lhs_index = add_non_terminal(g, name);
+    int len = strlen(rhs);
+    Symbol *symbols = malloc((len ? len : 1) * sizeof(Symbol));
+    int count = 0;
+
+    for (int i = 0; i < len; i++) {
+        if (rhs[i] == 'e') continue;
+        const char *close = rhs[i] == '{' ? strchr(rhs + i, '}') : NULL;
+        if (close) {
+            char token[16] = "";
+            if (close - rhs - i < (int)sizeof(token) - 1) memcpy(token, rhs + i, close - rhs - i + 1);
+            int action = find_action(token);
+            if (action >= 0) {
+                symbols[count++] = ACTION_SYMBOL(action);
+                i = close - rhs;
+                continue;
             }
         }
-    } while (changed);  // Continue until no changes in any FOLLOW set
+        name[0] = rhs[i];
+        int nt_index = get_non_terminal_index(g, name);
+        symbols[count++] = nt_index >= 0 ? NT_SYMBOL(nt_index) : add_terminal(g, name);
+    }
+    add_rule_symbols(g, lhs_index, symbols, count);
+    free(symbols);
 }
 
-// Function to create the LL(1) parsing table
-void create_parsing_table() {
-    // Initialize all entries to empty strings
-    for (int i = 0; i < non_terminal_count; i++) {
-        for (int j = 0; j < terminal_count; j++) {
-            strcpy(parsing_table[i][j], "");
+// Function to load a grammar file. Each line holds one non-terminal and its
+// alternatives, with symbols separated by whitespace:
+//     X -> + T {add} X | e
+// Every symbol that appears on a left-hand side is a non-terminal, 'e' (or ε)
+// is epsilon, "{name}" is a semantic action and everything else is a
+// terminal. The first LHS is the start symbol, and '#' starts a comment.
+// A line "%literal i" makes runs of digits read as terminal i.
+// Returns false on a malformed file or one with no productions.
+bool load_grammar(Grammar *g, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Cannot open grammar file '%s'\n", path);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    int line_number;
+    bool ok = true;
+    Symbol *symbols = NULL;
+    int symbol_capacity = 0;
+    char *save;
+
+    // Pass 1: every left-hand side is a non-terminal
+    line_number = 0;
+    while (getline(&line, &line_size, file) != -1) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *lhs = strtok_r(line, " \t\r\n", &save);
+        if (!lhs || lhs[0] == '%') continue;
+        char *arrow = strtok_r(NULL, " \t\r\n", &save);
+        if (!arrow || strcmp(arrow, "->") != 0) {
+            fprintf(stderr, "Error: %s:%d: expected 'A -> ...'\n", path, line_number);
+            ok = false;
+            break;
         }
+        add_non_terminal(g, lhs);
     }
 
-    // Populate the parsing table
-    for (int i = 0; i < rule_count; i++) {
-        char lhs = rules[i].lhs;
-        char *rhs = rules[i].rhs[0];
-        int lhs_index = get_non_terminal_index(lhs);
-
-        // Case 1: Production is A → ε
-        if (strcmp(rhs, "e") == 0) {
-            // For each terminal in FOLLOW(A), add A → ε
-            for (int k = 0; k < firstFollow[lhs_index].follow_count; k++) {
-                int term_index = get_terminal_index(firstFollow[lhs_index].follow[k]);
-                if (term_index != -1) {
-                    strcpy(parsing_table[lhs_index][term_index], "e");
-                }
+    // Pass 2: the productions
+    rewind(file);
+    line_number = 0;
+    while (ok && getline(&line, &line_size, file) != -1) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        char *lhs = strtok_r(line, " \t\r\n", &save);
+        if (!lhs) continue;
+        if (lhs[0] == '%') {
+            char *name = strtok_r(NULL, " \t\r\n", &save);
+            if (strcmp(lhs, "%literal") != 0 || !name || get_non_terminal_index(g, name) >= 0) {
+                fprintf(stderr, "Error: %s:%d: expected '%%literal terminal'\n", path, line_number);
+                ok = false;
+                break;
             }
+            set_literal_terminal(g, add_terminal(g, name));
+            continue;
         }
-        // Case 2: Production starts with a terminal
-        else if (is_terminal(rhs[0])) {
-            // Add production to table entry for A and the terminal
-            int term_index = get_terminal_index(rhs[0]);
-            if (term_index != -1) {
-                strcpy(parsing_table[lhs_index][term_index], rhs);
-            }
-        } 
-        // Case 3: Production starts with a non-terminal
-        else if (is_non_terminal(rhs[0])) {
-            int rhs_index = get_non_terminal_index(rhs[0]);
-
-            // For each terminal in FIRST(rhs[0]) (excluding ε), add production
-            for (int k = 0; k < firstFollow[rhs_index].first_count; k++) {
-                if (firstFollow[rhs_index].first[k] != 'e') {
-                    int term_index = get_terminal_index(firstFollow[rhs_index].first[k]);
-                    if (term_index != -1) {
-                        strcpy(parsing_table[lhs_index][term_index], rhs);
-                    }
+        strtok_r(NULL, " \t\r\n", &save);  // The arrow, checked in pass 1
+
+        int lhs_index = get_non_terminal_index(g, lhs);
+        int count = 0;
+        char *token;
+        while (true) {
+            token = strtok_r(NULL, " \t\r\n", &save);
+            if (!token || strcmp(token, "|") == 0) {
+                if (!add_rule_symbols(g, lhs_index, symbols, count)) {
+                    ok = false;
+                    break;
                 }
+                count = 0;
+                if (!token) break;
+                continue;
             }
+            if (strcmp(token, "e") == 0 || strcmp(token, "ε") == 0) continue;
 
-            // If FIRST(rhs[0]) contains ε, add production for terminals in FOLLOW(A)
-            if (contains_epsilon(firstFollow[rhs_index].first, firstFollow[rhs_index].first_count)) {
-                for (int k = 0; k < firstFollow[lhs_index].follow_count; k++) {
-                    int term_index = get_terminal_index(firstFollow[lhs_index].follow[k]);
-                    if (term_index != -1) {
-                        strcpy(parsing_table[lhs_index][term_index], rhs);
-                    }
+            symbols = grow_array(symbols, &symbol_capacity, count + 1, sizeof(Symbol));
+            if (token[0] == '{') {
+                int action = find_action(token);
+                if (action < 0) {
+                    fprintf(stderr, "Error: %s:%d: unknown action '%s'\n", path, line_number, token);
+                    ok = false;
+                    break;
                 }
+                symbols[count++] = ACTION_SYMBOL(action);
+                continue;
             }
+            int nt_index = get_non_terminal_index(g, token);
+            symbols[count++] = nt_index >= 0 ? NT_SYMBOL(nt_index) : add_terminal(g, token);
         }
     }
+
+    if (ok && g->rule_count == 0) {
+        fprintf(stderr, "Error: %s: no productions\n", path);
+        ok = false;
+    }
+
+    free(symbols);
+    free(line);
+    fclose(file);
+    return ok;
 }
 
-// Function to print FIRST and FOLLOW sets
-void print_first_follow() {
-    printf("\nFIRST sets:\n");
-    for (int i = 0; i < non_terminal_count; i++) {
-        printf("FIRST(%c) = { ", firstFollow[i].non_terminal);
-        for (int j = 0; j < firstFollow[i].first_count; j++) {
-            printf("%c ", firstFollow[i].first[j]);
+// Function to define the built-in expression grammar
+void add_expression_grammar(Grammar *g) {
+    // Declare symbols first so they print in this order
+    const char *terminal_names[] = {"i", "(", ")", "*", "+", "$"};
+    const char *non_terminal_names[] = {"E", "X", "T", "Y", "F"};
+    for (int i = 0; i < 6; i++) add_terminal(g, terminal_names[i]);
+    for (int i = 0; i < 5; i++) add_non_terminal(g, non_terminal_names[i]);
+
+    // The actions evaluate the expression; i also reads integer literals
+    add_rule(g, 'E', "TX");
+    add_rule(g, 'X', "+T{add}X");
+    add_rule(g, 'X', "e");
+    add_rule(g, 'T', "FY");
+    add_rule(g, 'Y', "*F{mul}Y");
+    add_rule(g, 'Y', "e");
+    add_rule(g, 'F', "(E)");
+    add_rule(g, 'F', "i");
+    set_literal_terminal(g, get_terminal_index(g, 'i'));
+}
+
+// Function to finish a grammar after its rules are added: the end marker is
+// always a terminal, and set storage is sized for the final symbol counts
+void finish_grammar(Grammar *g) {
+    add_terminal(g, "$");
+
+    int words = (g->terminals.count + 63) / 64;
+    g->set_words = words;
+    free(g->firstFollow);
+    free(g->set_storage);
+    g->firstFollow = calloc(g->non_terminals.count ? g->non_terminals.count : 1, sizeof(FirstFollow));
+    g->set_storage = calloc((size_t)g->non_terminals.count * 2 * words + 1, sizeof(uint64_t));
+    for (int i = 0; i < g->non_terminals.count; i++) {
+        g->firstFollow[i].first = g->set_storage + (size_t)i * 2 * words;
+        g->firstFollow[i].follow = g->firstFollow[i].first + words;
+    }
+}
+
+// Work-stealing thread pool. Tasks 0 .. task_count-1 are dealt out to the
+// workers as contiguous ranges. A worker takes tasks from the front of its own
+// range; once that is empty it steals from the back of the others'. Each
+// range is one atomic word (head << 32 | tail), so both ends are claimed with
+// a single compare-and-swap and no task runs twice.
+typedef void (*TaskFunction)(void *arg, int task, int worker);
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;    // Unclaimed tasks [head, tail)
+} WorkRange;
+
+typedef struct {
+    WorkRange *ranges;
+    int workers;
+    TaskFunction run;
+    void *arg;
+} ThreadPool;
+
+typedef struct {
+    ThreadPool *pool;
+    int worker;
+} PoolWorker;
+
+// Function to claim one task from a range: the front for its owner, the back for a thief
+static bool claim_task(WorkRange *range, bool steal, int *task) {
+    uint64_t current = atomic_load(&range->range);
+    while (true) {
+        uint32_t head = current >> 32;
+        uint32_t tail = (uint32_t)current;
+        if (head >= tail) return false;
+        uint64_t next = steal ? ((uint64_t)head << 32) | (tail - 1)
+                              : ((uint64_t)(head + 1) << 32) | tail;
+        if (atomic_compare_exchange_weak(&range->range, &current, next)) {
+            *task = steal ? (int)tail - 1 : (int)head;
+            return true;
         }
-        printf("}\n");
     }
-    
-    printf("\nFOLLOW sets:\n");
-    for (int i = 0; i < non_terminal_count; i++) {
-        printf("FOLLOW(%c) = { ", firstFollow[i].non_terminal);
-        for (int j = 0; j < firstFollow[i].follow_count; j++) {
-            printf("%c ", firstFollow[i].follow[j]);
+}
+
+static void *pool_worker(void *arg) {
+    PoolWorker *self = arg;
+    ThreadPool *pool = self->pool;
+    int task;
+
+    // Own range first, then steal round-robin until every range is empty
+    while (claim_task(&pool->ranges[self->worker], false, &task)) {
+        pool->run(pool->arg, task, self->worker);
+    }
+    for (int i = 1; i < pool->workers; i++) {
+        WorkRange *victim = &pool->ranges[(self->worker + i) % pool->workers];
+        while (claim_task(victim, true, &task)) {
+            pool->run(pool->arg, task, self->worker);
         }
-        printf("}\n");
     }
+    return NULL;
 }
 
-// Function to print the LL(1) parsing table
-void print_parsing_table() {
-    printf("\nLL(1) Parsing Table:\n");
-    printf("NonTerminal\\Terminal|");
-    for (int i = 0; i < terminal_count; i++) {
-        printf("%6c|", terminals[i]);
+// Function to run task_count tasks on `workers` threads (the caller is worker 0)
+static void run_parallel(int workers, int task_count, TaskFunction run, void *arg) {
+    ThreadPool pool = {aligned_alloc(64, workers * sizeof(WorkRange)), workers, run, arg};
+    PoolWorker *selves = malloc(workers * sizeof(PoolWorker));
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+
+    for (int w = 0; w < workers; w++) {
+        uint64_t head = (uint64_t)task_count * w / workers;
+        uint64_t tail = (uint64_t)task_count * (w + 1) / workers;
+        atomic_init(&pool.ranges[w].range, head << 32 | tail);
+        selves[w].pool = &pool;
+        selves[w].worker = w;
     }
-    printf("\n");
-    
-    printf("---------------------");
-    for (int i = 0; i < terminal_count; i++) {
-        printf("-------");
+    for (int w = 1; w < workers; w++) {
+        pthread_create(&threads[w], NULL, pool_worker, &selves[w]);
     }
-    printf("\n");
-    
-    for (int i = 0; i < non_terminal_count; i++) {
-        printf("%10c\t    |", non_terminals[i]);
-        for (int j = 0; j < terminal_count; j++) {
-            if (strcmp(parsing_table[i][j], "") != 0) {
-                if (strcmp(parsing_table[i][j], "e") == 0) {
-                    printf("%3c→e |", non_terminals[i]);
-                } else {
-                    printf("%3c→%s|", non_terminals[i], parsing_table[i][j]);
-                }
-            } else {
-                printf("%6s|", "");
-            }
+    pool_worker(&selves[0]);
+    for (int w = 1; w < workers; w++) {
+        pthread_join(threads[w], NULL);
+    }
+
+    free(threads);
+    free(selves);
+    free(pool.ranges);
+}
+
+// Function to get the default number of worker threads
+static int default_thread_count() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Function to add a terminal (by index) to a set
+static void set_add(uint64_t *set, int term_index) {
+    set[term_index / 64] |= (uint64_t)1 << (term_index % 64);
+}
+
+// Function to check if a terminal (by index) is in a set
+bool set_contains(const uint64_t *set, int term_index) {
+    return (set[term_index / 64] >> (term_index % 64)) & 1;
+}
+
+// Function to union src into dst; returns true if dst gained any terminal
+static bool set_union(uint64_t *dst, const uint64_t *src, int words) {
+    uint64_t added = 0;
+    for (int w = 0; w < words; w++) {
+        uint64_t merged = dst[w] | src[w];
+        added |= merged ^ dst[w];
+        dst[w] = merged;
+    }
+    return added != 0;
+}
+
+// Function to union FIRST(rhs) into a set; returns true if rhs can derive epsilon.
+// rhs is reversed (as stored in rhs_arena), so it is scanned from the end.
+static bool first_of_sequence(const Grammar *g, const Symbol *rhs, int len, uint64_t *set) {
+    for (int i = len - 1; i >= 0; i--) {
+        if (is_terminal(rhs[i])) {
+            set_add(set, rhs[i]);
+            return false;
         }
-        printf("\n");
+        int nt_index = NT_INDEX(rhs[i]);
+        set_union(set, g->firstFollow[nt_index].first, g->set_words);
+        if (!g->firstFollow[nt_index].first_epsilon) return false;
     }
+    return true;
 }
 
-// Function to parse input string using the parsing table
-bool parse_input(char *input) {
-    // Initialize stack with $ and start symbol
-    top = -1;
-    push('$');
-    push('E');  // Start symbol
-    
-    // Append $ to input
-    strcat(input, "$");
-    int input_ptr = 0;
-    
-    printf("\nParsing Steps:\n");
-    printf("Stack\t\tInput\t\tAction\n");
-    
-    while (top >= 0) {
-        // Print current stack and input
-        printf("%-15s\t%-15s\t", stack, input + input_ptr);
-        
-        char stack_top = peek();
-        char current_input = input[input_ptr];
-        
-        if (stack_top == current_input) {
-            // Match found
-            if (stack_top == '$') {
-                printf("Accept\n");
-                return true;
+// Dependency index used by the set computations: for every non-terminal, the rules
+// that mention it on their right-hand side and the rules it is the LHS of
+typedef struct {
+    int *uses_start;
+    int *uses_list;
+    int *lhs_start;
+    int *lhs_list;
+} RuleIndex;
+
+// Function to build the dependency index (counting sort into flat lists)
+static void index_rules(const Grammar *g, RuleIndex *index) {
+    int nt_count = g->non_terminals.count;
+    int uses_total = 0;
+
+    index->uses_start = calloc(nt_count + 1, sizeof(int));
+    index->lhs_start = calloc(nt_count + 1, sizeof(int));
+
+    for (int i = 0; i < g->rule_count; i++) {
+        const Symbol *rhs = rule_rhs(g, &g->rules[i]);
+        index->lhs_start[g->rules[i].lhs + 1]++;
+        for (int j = 0; j < g->rules[i].rhs_len; j++) {
+            if (!is_terminal(rhs[j])) {
+                index->uses_start[NT_INDEX(rhs[j]) + 1]++;
+                uses_total++;
             }
-            printf("Match %c\n", stack_top);
-            pop();
-            input_ptr++;
         }
-        else if (is_terminal(stack_top)) {
-            printf("Error: Terminal mismatch\n");
-            return false;
-        }
-        else {
-            // Non-terminal on stack - use parsing table
-            int nt_index = get_non_terminal_index(stack_top);
-            int t_index = get_terminal_index(current_input);
-            
-            if (nt_index == -1 || t_index == -1) {
-                printf("Error: Invalid symbol\n");
-                return false;
+    }
+    for (int i = 0; i < nt_count; i++) {
+        index->uses_start[i + 1] += index->uses_start[i];
+        index->lhs_start[i + 1] += index->lhs_start[i];
+    }
+
+    index->uses_list = malloc((uses_total ? uses_total : 1) * sizeof(int));
+    index->lhs_list = malloc((g->rule_count ? g->rule_count : 1) * sizeof(int));
+    int *uses_fill = malloc((nt_count ? nt_count : 1) * sizeof(int));
+    int *lhs_fill = malloc((nt_count ? nt_count : 1) * sizeof(int));
+    memcpy(uses_fill, index->uses_start, nt_count * sizeof(int));
+    memcpy(lhs_fill, index->lhs_start, nt_count * sizeof(int));
+    for (int i = 0; i < g->rule_count; i++) {
+        const Symbol *rhs = rule_rhs(g, &g->rules[i]);
+        index->lhs_list[lhs_fill[g->rules[i].lhs]++] = i;
+        for (int j = 0; j < g->rules[i].rhs_len; j++) {
+            if (!is_terminal(rhs[j])) {
+                index->uses_list[uses_fill[NT_INDEX(rhs[j])]++] = i;
             }
-            
-            if (strcmp(parsing_table[nt_index][t_index], "") == 0) {
-                printf("Error: No production in parsing table\n");
-                return false;
+        }
+    }
+    free(uses_fill);
+    free(lhs_fill);
+}
+
+static void free_rule_index(RuleIndex *index) {
+    free(index->uses_start);
+    free(index->uses_list);
+    free(index->lhs_start);
+    free(index->lhs_list);
+}
+
+// Function to reset all FIRST sets before a fixpoint run
+static void clear_first(Grammar *g) {
+    for (int i = 0; i < g->non_terminals.count; i++) {
+        memset(g->firstFollow[i].first, 0, g->set_words * sizeof(uint64_t));
+        g->firstFollow[i].first_epsilon = false;
+    }
+}
+
+// Function to reset all FOLLOW sets and seed $ into FOLLOW(start)
+static void clear_follow(Grammar *g) {
+    for (int i = 0; i < g->non_terminals.count; i++) {
+        memset(g->firstFollow[i].follow, 0, g->set_words * sizeof(uint64_t));
+    }
+    // Rule 1: $ is in FOLLOW(S) where S is the start symbol
+    set_add(g->firstFollow[g->start_symbol].follow, g->end_marker);
+}
+
+// Function to find the nullable non-terminals. Each rule counts down the
+// non-terminal occurrences on its right-hand side not yet known to be
+// nullable; a rule with a terminal never reaches zero. A rule whose count
+// reaches zero makes its LHS nullable, which is then propagated once.
+static void compute_nullable(const Grammar *g, const RuleIndex *index, bool *nullable) {
+    int nt_count = g->non_terminals.count;
+    int *pending = malloc((g->rule_count ? g->rule_count : 1) * sizeof(int));
+    int *queue = malloc((nt_count ? nt_count : 1) * sizeof(int));
+    int head = 0, tail = 0;
+
+    memset(nullable, 0, nt_count * sizeof(bool));
+    for (int r = 0; r < g->rule_count; r++) {
+        const ProductionRule *rule = &g->rules[r];
+        const Symbol *rhs = rule_rhs(g, rule);
+        pending[r] = rule->rhs_len;
+        for (int j = 0; j < rule->rhs_len; j++) {
+            if (is_terminal(rhs[j])) pending[r] = -1;
+        }
+        if (pending[r] == 0 && !nullable[rule->lhs]) {
+            nullable[rule->lhs] = true;
+            queue[tail++] = rule->lhs;
+        }
+    }
+    while (head < tail) {
+        int n = queue[head++];
+        for (int k = index->uses_start[n]; k < index->uses_start[n + 1]; k++) {
+            const ProductionRule *rule = &g->rules[index->uses_list[k]];
+            if (--pending[index->uses_list[k]] == 0 && !nullable[rule->lhs]) {
+                nullable[rule->lhs] = true;
+                queue[tail++] = rule->lhs;
             }
-            
-            char *production = parsing_table[nt_index][t_index];
-            printf("Apply %c -> %s\n", stack_top, production);
-            
-            pop();  // Remove non-terminal from stack
-            
-            // Push production in reverse order (except for epsilon)
-            if (strcmp(production, "e") != 0) {
-                for (int i = strlen(production) - 1; i >= 0; i--) {
-                    push(production[i]);
+        }
+    }
+    free(pending);
+    free(queue);
+}
+
+// Non-terminal dependency graph in compressed rows: computing the set of
+// non-terminal n reads the sets of edges[start[n] .. start[n + 1])
+typedef struct {
+    int *start;
+    int *edges;
+} DependencyGraph;
+
+// Function to build the graph FIRST (follow = false) or FOLLOW (follow = true)
+// is computed over. FIRST(A) reads FIRST(B) for every B in a rule of A up to
+// and including its first non-nullable symbol; FOLLOW(B) reads FOLLOW(A) for
+// every B in a rule of A that only nullable symbols follow.
+static void build_dependencies(const Grammar *g, const bool *nullable, bool follow, DependencyGraph *graph) {
+    int nt_count = g->non_terminals.count;
+    int *fill = NULL;
+
+    graph->start = calloc(nt_count + 1, sizeof(int));
+    graph->edges = NULL;
+
+    // The first pass counts the edges of each row, the second fills them in
+    for (int pass = 0; pass < 2; pass++) {
+        for (int r = 0; r < g->rule_count; r++) {
+            const ProductionRule *rule = &g->rules[r];
+            const Symbol *rhs = rule_rhs(g, rule);
+
+            // The reversed span is walked from its end for FIRST, from its start for FOLLOW
+            for (int k = 0; k < rule->rhs_len; k++) {
+                Symbol s = rhs[follow ? k : rule->rhs_len - 1 - k];
+                if (is_terminal(s)) break;
+                int from = follow ? NT_INDEX(s) : rule->lhs;
+                int to = follow ? rule->lhs : NT_INDEX(s);
+                if (pass == 0) {
+                    graph->start[from + 1]++;
+                } else {
+                    graph->edges[fill[from]++] = to;
                 }
+                if (!nullable[NT_INDEX(s)]) break;
             }
         }
+        if (pass == 0) {
+            for (int n = 0; n < nt_count; n++) graph->start[n + 1] += graph->start[n];
+            graph->edges = malloc((graph->start[nt_count] ? graph->start[nt_count] : 1) * sizeof(int));
+            fill = malloc((nt_count ? nt_count : 1) * sizeof(int));
+            memcpy(fill, graph->start, nt_count * sizeof(int));
+        }
     }
-    
-    return false;
+    free(fill);
 }
 
-int main() {
-    // Initialize grammar
-    add_rule('E', "TX");
-    add_rule('X', "+TX");
-    add_rule('X', "e");
-    add_rule('T', "FY");
-    add_rule('Y', "*FY");
-    add_rule('Y', "e");
-    add_rule('F', "(E)");
-    add_rule('F', "i");
-    
-    // Compute FIRST and FOLLOW sets
-    compute_first();
-    compute_follow();
-    
-    // Print the computed sets
-    print_first_follow();
-    
-    // Create and print the parsing table
-    create_parsing_table();
-    print_parsing_table();
-    
-    // Get input from user
-    char input[MAX_INPUT];
-    printf("\nEnter input string to parse: ");
-    scanf("%s", input);
-    
-    // Parse the input
-    if (parse_input(input)) {
-        printf("\nInput '%s' is ACCEPTED by the grammar\n", input);
-    } else {
-        printf("\nInput '%s' is REJECTED by the grammar\n", input);
+static void free_dependencies(DependencyGraph *graph) {
+    free(graph->start);
+    free(graph->edges);
+}
+
+// Strongly connected components of a dependency graph, grouped into levels:
+// a component's level is one more than the highest level it depends on, so
+// the components of one level only read sets that are already final
+typedef struct {
+    int count;                  // Number of components
+    int *component;             // Component of each non-terminal
+    int *member_start;          // Component c is members[member_start[c] .. member_start[c + 1])
+    int *members;
+    int level_count;
+    int *level_start;           // Level l is components order[level_start[l] .. level_start[l + 1])
+    int *order;
+    uint64_t *level_work;       // Estimated set-word operations of each level
+} ComponentSchedule;
+
+// Function to split a dependency graph into components with Tarjan's
+// algorithm, run with an explicit stack since the graph can be deep.
+// Components are found dependencies first, so levels fill in one pass.
+static void schedule_components(const DependencyGraph *graph, int nt_count, int set_words, ComponentSchedule *schedule) {
+    int slots = nt_count ? nt_count : 1;
+    int *order_of = malloc(slots * sizeof(int));    // DFS discovery order, -1 if unvisited
+    int *low = malloc(slots * sizeof(int));
+    int *next_edge = malloc(slots * sizeof(int));
+    int *path = malloc(slots * sizeof(int));        // Vertices of the current DFS path
+    int *stack = malloc(slots * sizeof(int));       // Vertices not yet assigned a component
+    bool *on_stack = calloc(slots, sizeof(bool));
+    int visited = 0, depth = 0, top = 0, placed = 0;
+
+    schedule->count = 0;
+    schedule->component = malloc(slots * sizeof(int));
+    schedule->member_start = malloc((slots + 1) * sizeof(int));
+    schedule->members = malloc(slots * sizeof(int));
+    for (int n = 0; n < nt_count; n++) order_of[n] = -1;
+
+    for (int root = 0; root < nt_count; root++) {
+        if (order_of[root] >= 0) continue;
+        order_of[root] = low[root] = visited++;
+        next_edge[root] = graph->start[root];
+        stack[top++] = root;
+        on_stack[root] = true;
+        path[depth++] = root;
+
+        while (depth > 0) {
+            int v = path[depth - 1];
+            if (next_edge[v] < graph->start[v + 1]) {
+                int w = graph->edges[next_edge[v]++];
+                if (order_of[w] < 0) {
+                    order_of[w] = low[w] = visited++;
+                    next_edge[w] = graph->start[w];
+                    stack[top++] = w;
+                    on_stack[w] = true;
+                    path[depth++] = w;
+                } else if (on_stack[w] && order_of[w] < low[v]) {
+                    low[v] = order_of[w];
+                }
+                continue;
+            }
+
+            depth--;
+            if (depth > 0 && low[v] < low[path[depth - 1]]) low[path[depth - 1]] = low[v];
+            if (low[v] == order_of[v]) {
+                // v roots a component: everything above it on the stack
+                schedule->member_start[schedule->count] = placed;
+                int w;
+                do {
+                    w = stack[--top];
+                    on_stack[w] = false;
+                    schedule->component[w] = schedule->count;
+                    schedule->members[placed++] = w;
+                } while (w != v);
+                schedule->count++;
+            }
+        }
     }
-    
-    return 0;
-}
\ No newline at end of file
+    schedule->member_start[schedule->count] = placed;
+
+    // Level of each component, reusing low; components are numbered after
+    // everything they depend on
+    int *level = low;
+    schedule->level_count = 0;
+    for (int c = 0; c < schedule->count; c++) {
+        level[c] = 0;
+        for (int m = schedule->member_start[c]; m < schedule->member_start[c + 1]; m++) {
+            int n = schedule->members[m];
+            for (int k = graph->start[n]; k < graph->start[n + 1]; k++) {
+                int d = schedule->component[graph->edges[k]];
+                if (d != c && level[d] + 1 > level[c]) level[c] = level[d] + 1;
+            }
+        }
+        if (level[c] + 1 > schedule->level_count) schedule->level_count = level[c] + 1;
+    }
+
+    // Group components by level (counting sort) and total each level's work
+    schedule->level_start = calloc(schedule->level_count + 1, sizeof(int));
+    schedule->level_work = calloc(schedule->level_count + 1, sizeof(uint64_t));
+    schedule->order = malloc((schedule->count ? schedule->count : 1) * sizeof(int));
+    for (int c = 0; c < schedule->count; c++) {
+        schedule->level_start[level[c] + 1]++;
+        for (int m = schedule->member_start[c]; m < schedule->member_start[c + 1]; m++) {
+            int n = schedule->members[m];
+            schedule->level_work[level[c]] += (uint64_t)(graph->start[n + 1] - graph->start[n] + 1) * set_words;
+        }
+    }
+    for (int l = 0; l < schedule->level_count; l++) schedule->level_start[l + 1] += schedule->level_start[l];
+    memcpy(next_edge, schedule->level_start, schedule->level_count * sizeof(int));
+    for (int c = 0; c < schedule->count; c++) schedule->order[next_edge[level[c]]++] = c;
+
+    free(order_of);
+    free(low);
+    free(next_edge);
+    free(path);
+    free(stack);
+    free(on_stack);
+}
+
+static void free_schedule(ComponentSchedule *schedule) {
+    free(schedule->component);
+    free(schedule->member_start);
+    free(schedule->members);
+    free(schedule->level_start);
+    free(schedule->order);
+    free(schedule->level_work);
+}
+
+// State shared by the component solvers while one level is being solved
+typedef struct {
+    Grammar *g;
+    const RuleIndex *index;
+    const bool *nullable;
+    const ComponentSchedule *schedule;
+    int level_first;            // Offset of the current level in schedule->order
+} SetJob;
+
+// Function to solve FIRST for one component. Its non-terminals all reach each
+// other, so they share one FIRST set: everything their rules can start with,
+// read from components that are already final. No iteration is needed.
+static void solve_first_component(void *arg, int task, int worker) {
+    const SetJob *job = arg;
+    Grammar *g = job->g;
+    const ComponentSchedule *schedule = job->schedule;
+    int c = schedule->order[job->level_first + task];
+    const int *members = schedule->members + schedule->member_start[c];
+    int member_count = schedule->member_start[c + 1] - schedule->member_start[c];
+    uint64_t *set = g->firstFollow[members[0]].first;
+    (void)worker;
+
+    for (int m = 0; m < member_count; m++) {
+        int a = members[m];
+        for (int k = job->index->lhs_start[a]; k < job->index->lhs_start[a + 1]; k++) {
+            const ProductionRule *rule = &g->rules[job->index->lhs_list[k]];
+            const Symbol *rhs = rule_rhs(g, rule);
+            for (int j = rule->rhs_len - 1; j >= 0; j--) {
+                if (is_terminal(rhs[j])) {
+                    set_add(set, rhs[j]);
+                    break;
+                }
+                int b = NT_INDEX(rhs[j]);
+                if (schedule->component[b] != c) set_union(set, g->firstFollow[b].first, g->set_words);
+                if (!job->nullable[b]) break;
+            }
+        }
+    }
+    for (int m = 0; m < member_count; m++) {
+        g->firstFollow[members[m]].first_epsilon = job->nullable[members[m]];
+        if (m > 0) memcpy(g->firstFollow[members[m]].first, set, g->set_words * sizeof(uint64_t));
+    }
+}
+
+// Function to solve FOLLOW for one component, which likewise shares one set:
+// FIRST of whatever follows each occurrence of its non-terminals, plus
+// FOLLOW(A) from other components where an occurrence can end a rule of A
+static void solve_follow_component(void *arg, int task, int worker) {
+    const SetJob *job = arg;
+    Grammar *g = job->g;
+    const ComponentSchedule *schedule = job->schedule;
+    const RuleIndex *index = job->index;
+    int c = schedule->order[job->level_first + task];
+    const int *members = schedule->members + schedule->member_start[c];
+    int member_count = schedule->member_start[c + 1] - schedule->member_start[c];
+    uint64_t *set = g->firstFollow[members[0]].follow;
+    (void)worker;
+
+    for (int m = 0; m < member_count; m++) {
+        int b = members[m];
+        if (m > 0) set_union(set, g->firstFollow[b].follow, g->set_words);   // $ in FOLLOW(start)
+
+        for (int k = index->uses_start[b]; k < index->uses_start[b + 1]; k++) {
+            // A rule is listed once per occurrence, consecutively; visit it once
+            if (k > index->uses_start[b] && index->uses_list[k - 1] == index->uses_list[k]) continue;
+            const ProductionRule *rule = &g->rules[index->uses_list[k]];
+            const Symbol *rhs = rule_rhs(g, rule);
+
+            for (int j = 0; j < rule->rhs_len; j++) {
+                if (rhs[j] != NT_SYMBOL(b)) continue;
+                // What follows the occurrence is rhs[j-1] down to rhs[0]
+                int i = j - 1;
+                for (; i >= 0; i--) {
+                    if (is_terminal(rhs[i])) {
+                        set_add(set, rhs[i]);
+                        break;
+                    }
+                    set_union(set, g->firstFollow[NT_INDEX(rhs[i])].first, g->set_words);
+                    if (!job->nullable[NT_INDEX(rhs[i])]) break;
+                }
+                if (i < 0 && schedule->component[rule->lhs] != c) {
+                    set_union(set, g->firstFollow[rule->lhs].follow, g->set_words);
+                }
+            }
+        }
+    }
+    for (int m = 1; m < member_count; m++) {
+        memcpy(g->firstFollow[members[m]].follow, set, g->set_words * sizeof(uint64_t));
+    }
+}
+
+// Function to solve a schedule level by level. The components of a level are
+// independent, so a level with enough work is spread over the thread pool;
+// smaller levels run on the calling thread, where starting threads would cost
+// more than the level itself.
+static void solve_components(SetJob *job, int threads, TaskFunction solve) {
+    const ComponentSchedule *schedule = job->schedule;
+
+    for (int l = 0; l < schedule->level_count; l++) {
+        int count = schedule->level_start[l + 1] - schedule->level_start[l];
+        job->level_first = schedule->level_start[l];
+        if (threads > 1 && count > 1 && schedule->level_work[l] >= PARALLEL_SET_WORK) {
+            run_parallel(threads < count ? threads : count, count, solve, job);
+        } else {
+            for (int t = 0; t < count; t++) solve(job, t, 0);
+        }
+    }
+}
+
+// Function to compute FIRST sets for all non-terminals on up to `threads`
+// threads (0 = one per online CPU). Nullability is found first, which fixes
+// the dependency graph; its components are then solved in dependency order,
+// each in one pass, so a slow cycle only costs its own component.
+void compute_first_threads(Grammar *g, int threads) {
+    RuleIndex index;
+    DependencyGraph graph;
+    ComponentSchedule schedule;
+    bool *nullable = malloc(g->non_terminals.count + 1);
+    PROFILE_PHASE_BEGIN();
+
+    if (threads <= 0) threads = default_thread_count();
+    index_rules(g, &index);
+    compute_nullable(g, &index, nullable);
+    build_dependencies(g, nullable, false, &graph);
+    schedule_components(&graph, g->non_terminals.count, g->set_words, &schedule);
+
+    clear_first(g);
+    SetJob job = {g, &index, nullable, &schedule, 0};
+    solve_components(&job, threads, solve_first_component);
+
+    free_schedule(&schedule);
+    free_dependencies(&graph);
+    free_rule_index(&index);
+    free(nullable);
+    PROFILE_PHASE_END(g, PROFILE_FIRST);
+}
+
+// Function to compute FOLLOW sets for all non-terminals the same way, over
+// the FOLLOW dependency graph. FIRST sets must already be computed.
+void compute_follow_threads(Grammar *g, int threads) {
+    RuleIndex index;
+    DependencyGraph graph;
+    ComponentSchedule schedule;
+    bool *nullable = malloc(g->non_terminals.count + 1);
+    PROFILE_PHASE_BEGIN();
+
+    if (threads <= 0) threads = default_thread_count();
+    for (int n = 0; n < g->non_terminals.count; n++) nullable[n] = g->firstFollow[n].first_epsilon;
+    index_rules(g, &index);
+    build_dependencies(g, nullable, true, &graph);
+    schedule_components(&graph, g->non_terminals.count, g->set_words, &schedule);
+
+    clear_follow(g);
+    SetJob job = {g, &index, nullable, &schedule, 0};
+    solve_components(&job, threads, solve_follow_component);
+
+    free_schedule(&schedule);
+    free_dependencies(&graph);
+    free_rule_index(&index);
+    free(nullable);
+    PROFILE_PHASE_END(g, PROFILE_FOLLOW);
+}
+
+void compute_first(Grammar *g) {
+    compute_first_threads(g, 0);
+}
+
+void compute_follow(Grammar *g) {
+    compute_follow_threads(g, 0);
+}
+
+// Function to look up a parsing table cell. A packed slot holds
+// (non-terminal + 1) << 16 | production, so a slot that is free or belongs to
+// another row reads as an error entry.
+static ALWAYS_INLINE TableEntry lookup_entry(const Grammar *g, int nt, int t, bool packed) {
+    if (!packed) return g->parsing_table[(size_t)nt * g->terminals.count + t];
+    uint32_t cell = g->packed_cells[g->row_base[nt] + t];
+    return cell >> 16 == (uint32_t)nt + 1 ? (TableEntry)cell : NO_PRODUCTION;
+}
+
+// Function to look up the expansion chain of a parsing table cell, or
+// CHAIN_NONE for an error entry. Chains are indexed like the table's cells.
+static ALWAYS_INLINE uint32_t lookup_chain(const Grammar *g, int nt, int t, bool packed) {
+    if (!packed) return g->chain_index[(size_t)nt * g->terminals.count + t];
+    uint32_t slot = g->row_base[nt] + t;
+    return g->packed_cells[slot] >> 16 == (uint32_t)nt + 1 ? g->chain_index[slot] : CHAIN_NONE;
+}
+
+// Function to get a parsing table cell in whichever layout the table has
+TableEntry table_entry(const Grammar *g, int nt, int t) {
+    return lookup_entry(g, nt, t, g->row_base != NULL);
+}
+
+// Function to find the first free packed slot at or after `slot`. Taken
+// slots link forward, with the links shortened as they are followed.
+static int next_free_slot(int *next_free, int slot) {
+    while (next_free[slot] != slot) {
+        next_free[slot] = next_free[next_free[slot]];
+        slot = next_free[slot];
+    }
+    return slot;
+}
+
+// Function to pack the dense table by row displacement ("comb" packing): all
+// rows are overlaid in one array, each shifted by its own base so that its
+// filled cells land on free slots. Rows are placed largest first, each at the
+// lowest base where it fits, searching from the base of the previous row of
+// the same size; a base that collides is advanced straight to the next one
+// that puts the colliding cell on a free slot. A row that has not fit
+// after PACK_MAX_PROBES bases, or has more than 1/PACK_MAX_DENSITY of its
+// cells filled, starts past the last entry placed so far. Every slot records
+// its row, so lookups give exactly the dense table's entries. Unless `force`
+// is set, only large tables with at most 1/PACK_MAX_DENSITY cells filled are
+// packed. Returns false, leaving the table dense, if packing does not at least
+// halve its size.
+static bool pack_parsing_table(Grammar *g, bool force) {
+    int nt_count = g->non_terminals.count;
+    int t_count = g->terminals.count;
+    size_t dense_bytes = (size_t)nt_count * t_count * sizeof(TableEntry);
+    if (nt_count >= 0xFFFF || t_count == 0 || (!force && dense_bytes < PACK_MIN_BYTES)) return false;
+
+    int *filled = calloc(nt_count + 1, sizeof(int));
+    size_t filled_total = 0;
+    for (int n = 0; n < nt_count; n++) {
+        for (int t = 0; t < t_count; t++) filled[n] += g->parsing_table[(size_t)n * t_count + t] != NO_PRODUCTION;
+        filled_total += filled[n];
+    }
+    if (!force && filled_total * PACK_MAX_DENSITY > (size_t)nt_count * t_count) {
+        free(filled);
+        return false;
+    }
+
+    // Rows by decreasing fill (counting sort)
+    int *order = malloc((nt_count + 1) * sizeof(int));
+    int *bucket = calloc(t_count + 2, sizeof(int));
+    for (int n = 0; n < nt_count; n++) bucket[t_count - filled[n] + 1]++;
+    for (int k = 0; k <= t_count; k++) bucket[k + 1] += bucket[k];
+    for (int n = 0; n < nt_count; n++) order[bucket[t_count - filled[n]]++] = n;
+
+    int32_t *row_base = calloc(nt_count + 1, sizeof(int32_t));
+    int *columns = malloc(t_count * sizeof(int));
+    uint32_t *cells = NULL;
+    int *next_free = NULL;      // Free slot search links, one more than cells
+    int capacity = 0;
+    int link_capacity = 0;
+    int end = 0;                // First slot past every entry
+    int hint = 0;               // Base of the last row placed with `last_count` entries
+    int last_count = -1;
+    int size = t_count;         // Slots any lookup can reach
+
+    for (int k = 0; k < nt_count && filled[order[k]] > 0; k++) {
+        int n = order[k];
+        const TableEntry *row = g->parsing_table + (size_t)n * t_count;
+        int count = 0;
+        for (int t = 0; t < t_count; t++) {
+            if (row[t] != NO_PRODUCTION) columns[count++] = t;
+        }
+
+        if (count != last_count) hint = 0;
+        last_count = count;
+        int base = hint;
+        int probes = count * PACK_MAX_DENSITY > t_count ? 0 : PACK_MAX_PROBES;
+        while (true) {
+            if (probes-- == 0 && end - columns[0] > base) base = end - columns[0];
+            if (base + t_count > capacity) {
+                int old_capacity = capacity;
+                cells = grow_array(cells, &capacity, base + t_count, sizeof(uint32_t));
+                memset(cells + old_capacity, 0, (size_t)(capacity - old_capacity) * sizeof(uint32_t));
+                int old_links = link_capacity;
+                next_free = grow_array(next_free, &link_capacity, capacity + 1, sizeof(int));
+                for (int i = old_links; i < link_capacity; i++) next_free[i] = i;
+            }
+            int c = 0;
+            while (c < count && cells[base + columns[c]] == 0) c++;
+            if (c == count) break;
+            base = next_free_slot(next_free, base + columns[c]) - columns[c];
+        }
+
+        row_base[n] = base;
+        hint = base;
+        for (int c = 0; c < count; c++) {
+            cells[base + columns[c]] = (uint32_t)(n + 1) << 16 | row[columns[c]];
+            next_free[base + columns[c]] = base + columns[c] + 1;
+        }
+        if (base + columns[count - 1] + 1 > end) end = base + columns[count - 1] + 1;
+        if (base + t_count > size) size = base + t_count;
+    }
+    free(filled);
+    free(order);
+    free(bucket);
+    free(columns);
+    free(next_free);
+
+    // Rows without entries keep base 0, which no slot of theirs can match
+    if (capacity < size) {
+        cells = grow_array(cells, &capacity, size, sizeof(uint32_t));
+        memset(cells, 0, (size_t)size * sizeof(uint32_t));
+    }
+    size_t packed_bytes = (size_t)size * sizeof(uint32_t) + (size_t)nt_count * sizeof(int32_t);
+    if (!force && packed_bytes * 2 > dense_bytes) {
+        free(cells);
+        free(row_base);
+        return false;
+    }
+
+    g->packed_cells = realloc(cells, (size_t)size * sizeof(uint32_t));
+    g->packed_count = size;
+    g->row_base = row_base;
+    free(g->parsing_table);
+    g->parsing_table = NULL;
+    return true;
+}
+
+// Function to precompute the expansion chain of every filled table cell (see
+// CHAIN_HEADER) by running the parser's expansion steps on a scratch stack.
+// The chain stops at an error entry, which the parse loop then reports at the
+// same step as without chains. One-step chains depend only on the production,
+// so they are stored once per production.
+static void build_expansion_chains(Grammar *g) {
+    int t_count = g->terminals.count;
+    size_t slots = g->row_base ? (size_t)g->packed_count : (size_t)g->non_terminals.count * t_count;
+    free(g->chain_index);
+    g->chain_index = malloc((slots ? slots : 1) * sizeof(uint32_t));
+    for (size_t s = 0; s < slots; s++) g->chain_index[s] = CHAIN_NONE;
+    g->chain_count = 0;
+
+    uint32_t *single = malloc((g->rule_count + 1) * sizeof(uint32_t));
+    for (int r = 0; r < g->rule_count; r++) single[r] = CHAIN_NONE;
+    int32_t productions[CHAIN_MAX_STEPS];
+    Symbol *stack = NULL;
+    int stack_capacity = 0;
+
+    for (size_t s = 0; s < slots; s++) {
+        int n, t;
+        TableEntry entry;
+        if (g->row_base) {
+            if (g->packed_cells[s] == 0) continue;
+            n = (g->packed_cells[s] >> 16) - 1;
+            t = s - g->row_base[n];
+            entry = (TableEntry)g->packed_cells[s];
+        } else {
+            n = s / t_count;
+            t = s % t_count;
+            entry = g->parsing_table[s];
+        }
+        if (entry == NO_PRODUCTION) continue;
+        if (single[entry] != CHAIN_NONE) {
+            // Only a production starting with a non-terminal can chain further
+            const ProductionRule *rule = &g->rules[entry];
+            Symbol leftmost = rule->rhs_len ? rule_rhs(g, rule)[rule->rhs_len - 1] : 0;
+            if (is_terminal(leftmost) || table_entry(g, NT_INDEX(leftmost), t) == NO_PRODUCTION) {
+                g->chain_index[s] = single[entry];
+                continue;
+            }
+        }
+
+        // Expand with lookahead t until a terminal is on top or the chain's
+        // own symbols run out
+        int len = 1, peak = 1, steps = 0;
+        stack = grow_array(stack, &stack_capacity, 1, sizeof(Symbol));
+        stack[0] = NT_SYMBOL(n);
+        while (true) {
+            const ProductionRule *rule = &g->rules[entry];
+            stack = grow_array(stack, &stack_capacity, len + rule->rhs_len, sizeof(Symbol));
+            memcpy(stack + len - 1, rule_rhs(g, rule), rule->rhs_len * sizeof(Symbol));
+            len += rule->rhs_len - 1;
+            if (len > peak) peak = len;
+            productions[steps++] = entry;
+            if (len == 0 || is_terminal(stack[len - 1]) || steps == CHAIN_MAX_STEPS) break;
+            entry = table_entry(g, NT_INDEX(stack[len - 1]), t);
+            if (entry == NO_PRODUCTION) break;
+        }
+
+        uint32_t chain = g->chain_count;
+        g->chain_arena = grow_array(g->chain_arena, &g->chain_capacity,
+                                    g->chain_count + CHAIN_HEADER + steps + len, sizeof(int32_t));
+        int32_t *record = g->chain_arena + chain;
+        record[0] = steps;
+        record[1] = len;
+        record[2] = peak;
+        memcpy(record + CHAIN_HEADER, productions, steps * sizeof(int32_t));
+        memcpy(record + CHAIN_HEADER + steps, stack, len * sizeof(Symbol));
+        g->chain_count += CHAIN_HEADER + steps + len;
+        if (steps == 1) single[productions[0]] = chain;
+        g->chain_index[s] = chain;
+    }
+    free(single);
+    free(stack);
+}
+
+// Source of Grammar.table_id, so that a result cache never mistakes a new
+// table for a freed one at the same address
+static _Atomic uint64_t last_table_id;
+
+// Function to create the LL(1) parsing table. It is built dense, then packed
+// when it is large and sparse enough (see pack_parsing_table), and the
+// expansion chains are built for the final layout. A cell two productions
+// claim keeps the later one and is recorded as the grammar's conflict;
+// returns false if there is one.
+bool create_parsing_table(Grammar *g) {
+    PROFILE_PHASE_BEGIN();
+    g->conflict_lhs = -1;
+    g->conflict_terminal = -1;
+
+    // Initialize all entries to empty
+    size_t cells = (size_t)g->non_terminals.count * g->terminals.count;
+    free(g->parsing_table);
+    free(g->row_base);
+    free(g->packed_cells);
+    g->row_base = NULL;
+    g->packed_cells = NULL;
+    g->packed_count = 0;
+    g->parsing_table = malloc((cells ? cells : 1) * sizeof(TableEntry));
+    for (size_t c = 0; c < cells; c++) g->parsing_table[c] = NO_PRODUCTION;
+    uint64_t *first = malloc(g->set_words * sizeof(uint64_t) + 1);
+
+    // Populate the parsing table
+    for (int i = 0; i < g->rule_count; i++) {
+        const ProductionRule *rule = &g->rules[i];
+
+        // A → α goes in every column of FIRST(α)...
+        memset(first, 0, g->set_words * sizeof(uint64_t));
+        bool nullable = first_of_sequence(g, rule_rhs(g, rule), rule->rhs_len, first);
+
+        // ...and, if α can derive ε, in every column of FOLLOW(A)
+        if (nullable) {
+            set_union(first, g->firstFollow[rule->lhs].follow, g->set_words);
+        }
+
+        for (int t = 0; t < g->terminals.count; t++) {
+            if (!set_contains(first, t)) continue;
+            TableEntry *cell = &g->parsing_table[(size_t)rule->lhs * g->terminals.count + t];
+            if (*cell != NO_PRODUCTION && *cell != i && g->conflict_lhs < 0) {
+                g->conflict_lhs = rule->lhs;
+                g->conflict_terminal = t;
+            }
+            *cell = i;
+        }
+    }
+    free(first);
+    pack_parsing_table(g, false);
+    build_expansion_chains(g);
+    g->table_id = atomic_fetch_add(&last_table_id, 1) + 1;
+    PROFILE_PHASE_END(g, PROFILE_TABLE);
+    return g->conflict_lhs < 0;
+}
+
+// Function to report a grammar's first LL(1) conflict, if it has one.
+// Returns false if it did.
+static bool check_ll1(const Grammar *g, const char *path) {
+    if (g->conflict_lhs < 0) return true;
+    fprintf(stderr, "Error: %s: grammar is not LL(1): conflict at [%s, %s]\n", path,
+            g->non_terminals.names[g->conflict_lhs], g->terminals.names[g->conflict_terminal]);
+    return false;
+}
+
+// Function to run the whole pipeline on a grammar whose rules are all added.
+// Returns false if the grammar is not LL(1).
+bool compile_grammar(Grammar *g) {
+    finish_grammar(g);
+    compute_first(g);
+    compute_follow(g);
+    return create_parsing_table(g);
+}
+
+// Compiled grammar file layout: this header, then each section at a 64-byte
+// aligned offset. Sections are raw native-endian arrays so they can be used
+// straight from the mapping; only the name and set pointer arrays are rebuilt.
+#define GRAMMAR_MAGIC "LL1GRAM"
+#define GRAMMAR_VERSION 3
+#define GRAMMAR_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];                  // GRAMMAR_MAGIC
+    uint32_t version;               // GRAMMAR_VERSION
+    uint32_t byte_order;            // GRAMMAR_BYTE_ORDER as written by the producer
+    uint32_t terminal_count;
+    uint32_t non_terminal_count;
+    uint32_t rule_count;
+    uint32_t arena_count;
+    int32_t start_symbol;
+    int32_t end_marker;
+    uint32_t set_words;
+    uint32_t terminal_slot_count;
+    uint32_t non_terminal_slot_count;
+    int32_t literal_terminal;
+    uint64_t file_size;
+    uint64_t names_offset;          // Terminal then non-terminal names, NUL-terminated
+    uint64_t names_size;
+    uint64_t byte_map_offset;       // int32_t[256]
+    uint64_t terminal_slots_offset; // int32_t[terminal_slot_count]
+    uint64_t non_terminal_slots_offset;
+    uint64_t rules_offset;          // ProductionRule[rule_count]
+    uint64_t arena_offset;          // Symbol[arena_count]
+    uint64_t sets_offset;           // uint64_t[non_terminal_count * 2 * set_words]
+    uint64_t epsilon_offset;        // uint8_t[non_terminal_count]
+    uint64_t table_offset;          // TableEntry[non_terminal_count * terminal_count]
+    uint64_t chain_index_offset;    // uint32_t[non_terminal_count * terminal_count]
+    uint64_t chain_arena_offset;    // int32_t[chain_count]
+    uint64_t chain_count;
+} GrammarFileHeader;
+
+// Function to reserve an aligned section in the file layout
+static uint64_t layout_section(uint64_t *end, uint64_t size) {
+    uint64_t offset = (*end + 63) & ~(uint64_t)63;
+    *end = offset + size;
+    return offset;
+}
+
+// Function to write one section at its offset, zero-padding up to it
+static bool write_section(FILE *out, uint64_t offset, const void *data, uint64_t size) {
+    static const char zeros[64];
+    long pos = ftell(out);
+    if (pos < 0 || (uint64_t)pos > offset) return false;
+    if (fwrite(zeros, 1, offset - pos, out) != offset - pos) return false;
+    return fwrite(data, 1, size, out) == size;
+}
+
+// Function to write the parsing table section, which is always dense; a
+// packed table is expanded a row at a time
+static bool write_table_section(FILE *out, uint64_t offset, const Grammar *g) {
+    int t_count = g->terminals.count;
+    if (!g->row_base) {
+        return write_section(out, offset, g->parsing_table, (uint64_t)g->non_terminals.count * t_count * sizeof(TableEntry));
+    }
+    TableEntry *row = malloc((t_count + 1) * sizeof(TableEntry));
+    bool ok = write_section(out, offset, row, 0);
+    for (int n = 0; ok && n < g->non_terminals.count; n++) {
+        for (int t = 0; t < t_count; t++) row[t] = table_entry(g, n, t);
+        ok = fwrite(row, sizeof(TableEntry), t_count, out) == (size_t)t_count;
+    }
+    free(row);
+    return ok;
+}
+
+// Function to write the expansion chain index section, which is dense like
+// the table section
+static bool write_chain_index_section(FILE *out, uint64_t offset, const Grammar *g) {
+    int t_count = g->terminals.count;
+    if (!g->row_base) {
+        return write_section(out, offset, g->chain_index, (uint64_t)g->non_terminals.count * t_count * sizeof(uint32_t));
+    }
+    uint32_t *row = malloc((t_count + 1) * sizeof(uint32_t));
+    bool ok = write_section(out, offset, row, 0);
+    for (int n = 0; ok && n < g->non_terminals.count; n++) {
+        for (int t = 0; t < t_count; t++) row[t] = lookup_chain(g, n, t, true);
+        ok = fwrite(row, sizeof(uint32_t), t_count, out) == (size_t)t_count;
+    }
+    free(row);
+    return ok;
+}
+
+// Function to write a compiled grammar to a file. Returns false on I/O errors.
+bool save_grammar(const Grammar *g, const char *path) {
+    GrammarFileHeader header;
+    uint64_t end = sizeof(header);
+    int nt_count = g->non_terminals.count;
+    int t_count = g->terminals.count;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRAMMAR_MAGIC, sizeof(header.magic));
+    header.version = GRAMMAR_VERSION;
+    header.byte_order = GRAMMAR_BYTE_ORDER;
+    header.terminal_count = t_count;
+    header.non_terminal_count = nt_count;
+    header.rule_count = g->rule_count;
+    header.arena_count = g->arena_count;
+    header.start_symbol = g->start_symbol;
+    header.end_marker = g->end_marker;
+    header.literal_terminal = g->literal_terminal;
+    header.set_words = g->set_words;
+    header.terminal_slot_count = g->terminals.slot_count;
+    header.non_terminal_slot_count = g->non_terminals.slot_count;
+
+    // Names are stored back to back, terminals first
+    uint64_t names_size = 0;
+    for (int i = 0; i < t_count; i++) names_size += strlen(g->terminals.names[i]) + 1;
+    for (int i = 0; i < nt_count; i++) names_size += strlen(g->non_terminals.names[i]) + 1;
+    char *names = malloc(names_size + 1);
+    char *fill = names;
+    for (int i = 0; i < t_count; i++) fill = stpcpy(fill, g->terminals.names[i]) + 1;
+    for (int i = 0; i < nt_count; i++) fill = stpcpy(fill, g->non_terminals.names[i]) + 1;
+
+    uint8_t *epsilon = malloc(nt_count + 1);
+    for (int i = 0; i < nt_count; i++) epsilon[i] = g->firstFollow[i].first_epsilon;
+
+    uint64_t sets_size = (uint64_t)nt_count * 2 * g->set_words * sizeof(uint64_t);
+    uint64_t table_size = (uint64_t)nt_count * t_count * sizeof(TableEntry);
+    header.names_offset = layout_section(&end, names_size);
+    header.names_size = names_size;
+    header.byte_map_offset = layout_section(&end, sizeof(g->terminal_of_byte));
+    header.terminal_slots_offset = layout_section(&end, g->terminals.slot_count * sizeof(int));
+    header.non_terminal_slots_offset = layout_section(&end, g->non_terminals.slot_count * sizeof(int));
+    header.rules_offset = layout_section(&end, g->rule_count * sizeof(ProductionRule));
+    header.arena_offset = layout_section(&end, g->arena_count * sizeof(Symbol));
+    header.sets_offset = layout_section(&end, sets_size);
+    header.epsilon_offset = layout_section(&end, nt_count);
+    header.table_offset = layout_section(&end, table_size);
+    header.chain_index_offset = layout_section(&end, (uint64_t)nt_count * t_count * sizeof(uint32_t));
+    header.chain_arena_offset = layout_section(&end, (uint64_t)g->chain_count * sizeof(int32_t));
+    header.chain_count = g->chain_count;
+    header.file_size = end;
+
+    FILE *out = fopen(path, "wb");
+    bool ok = out
+        && write_section(out, 0, &header, sizeof(header))
+        && write_section(out, header.names_offset, names, names_size)
+        && write_section(out, header.byte_map_offset, g->terminal_of_byte, sizeof(g->terminal_of_byte))
+        && write_section(out, header.terminal_slots_offset, g->terminals.slots, g->terminals.slot_count * sizeof(int))
+        && write_section(out, header.non_terminal_slots_offset, g->non_terminals.slots, g->non_terminals.slot_count * sizeof(int))
+        && write_section(out, header.rules_offset, g->rules, g->rule_count * sizeof(ProductionRule))
+        && write_section(out, header.arena_offset, g->rhs_arena, g->arena_count * sizeof(Symbol))
+        && write_section(out, header.sets_offset, g->set_storage, sets_size)
+        && write_section(out, header.epsilon_offset, epsilon, nt_count)
+        && write_table_section(out, header.table_offset, g)
+        && write_chain_index_section(out, header.chain_index_offset, g)
+        && write_section(out, header.chain_arena_offset, g->chain_arena, (uint64_t)g->chain_count * sizeof(int32_t));
+    if (out && fclose(out) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Error: Cannot write compiled grammar '%s'\n", path);
+
+    free(names);
+    free(epsilon);
+    return ok;
+}
+
+// Function to check whether a file starts with the compiled grammar magic
+bool is_compiled_grammar_file(const char *path) {
+    char magic[8];
+    FILE *file = fopen(path, "rb");
+    if (!file) return false;
+    bool match = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+              && memcmp(magic, GRAMMAR_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return match;
+}
+
+// Function to check that a section lies inside the file at a 64-byte
+// aligned offset, so its arrays can be used in place
+static bool section_fits(const GrammarFileHeader *header, uint64_t offset, uint64_t size) {
+    return offset % 64 == 0 && offset <= header->file_size && size <= header->file_size - offset;
+}
+
+// Function to check a mapped symbol table's hash slots: a power-of-two
+// count, every slot empty or holding an ID + 1, and an empty slot to end
+// every probe
+static bool slots_valid(const SymbolTable *table) {
+    if (table->slot_count == 0) return true;
+    if (table->slot_count & (table->slot_count - 1)) return false;
+    int empty = 0;
+    for (int i = 0; i < table->slot_count; i++) {
+        if (table->slots[i] < 0 || table->slots[i] > table->count) return false;
+        empty += table->slots[i] == 0;
+    }
+    return empty > 0;
+}
+
+// Function to check that a span of rhs_arena holds only grammar symbols,
+// or action symbols too when `actions` is set
+static bool span_valid(const Grammar *g, int start, int len, bool actions) {
+    if (start < 0 || len < 0 || start > g->arena_count || len > g->arena_count - start) return false;
+    for (int i = start; i < start + len; i++) {
+        Symbol s = g->rhs_arena[i];
+        bool valid = is_terminal(s) ? s < g->terminals.count : NT_INDEX(s) < g->non_terminals.count;
+        if (!valid && !(actions && s >= ACTION_BASE && s < ACTION_SYMBOL(ACTION_COUNT))) return false;
+    }
+    return true;
+}
+
+// Function to check every index a mapped grammar stores against the count
+// it indexes, so that a corrupt file is rejected instead of read out of
+// bounds while parsing. The table is always dense in a mapped grammar.
+static bool grammar_indices_valid(const Grammar *g) {
+    int t_count = g->terminals.count;
+    int nt_count = g->non_terminals.count;
+    if (g->start_symbol < 0 || g->start_symbol >= nt_count) return false;
+    if (g->end_marker < 0 || g->end_marker >= t_count) return false;
+    if (g->literal_terminal < -1 || g->literal_terminal >= t_count) return false;
+    if (!slots_valid(&g->terminals) || !slots_valid(&g->non_terminals)) return false;
+    for (int c = 0; c < 256; c++) {
+        if (g->terminal_of_byte[c] < -1 || g->terminal_of_byte[c] >= t_count) return false;
+    }
+    if (!span_valid(g, 0, g->arena_count, true)) return false;
+    for (int r = 0; r < g->rule_count; r++) {
+        const ProductionRule *rule = &g->rules[r];
+        if (rule->lhs < 0 || rule->lhs >= nt_count) return false;
+        if (!span_valid(g, rule->rhs_start, rule->rhs_len, false)) return false;
+        if (!span_valid(g, rule->eval_start, rule->eval_len, true)) return false;
+    }
+    size_t cells = (size_t)nt_count * t_count;
+    for (size_t s = 0; s < cells; s++) {
+        if (g->parsing_table[s] != NO_PRODUCTION && g->parsing_table[s] >= g->rule_count) return false;
+    }
+
+    // Walk the chain records back to back, marking where each starts
+    bool valid = true;
+    uint8_t *starts = calloc(g->chain_count + 1, 1);
+    for (int64_t at = 0; valid && at < g->chain_count; ) {
+        const int32_t *record = g->chain_arena + at;
+        int64_t left = g->chain_count - at - CHAIN_HEADER;
+        valid = left >= 0 && record[0] >= 1 && record[0] <= CHAIN_MAX_STEPS
+             && record[1] >= 0 && record[1] <= left - record[0] && record[2] >= record[1];
+        for (int k = 0; valid && k < record[0]; k++) {
+            valid = record[CHAIN_HEADER + k] >= 0 && record[CHAIN_HEADER + k] < g->rule_count;
+        }
+        for (int k = 0; valid && k < record[1]; k++) {
+            Symbol s = record[CHAIN_HEADER + record[0] + k];
+            valid = is_terminal(s) ? s < t_count : NT_INDEX(s) < nt_count;
+        }
+        if (!valid) break;
+        starts[at] = 1;
+        at += CHAIN_HEADER + record[0] + record[1];
+    }
+    for (size_t s = 0; valid && s < cells; s++) {
+        uint32_t chain = g->chain_index[s];
+        valid = chain == CHAIN_NONE || (chain < (uint32_t)g->chain_count && starts[chain]);
+    }
+    free(starts);
+    return valid;
+}
+
+// Function to map a compiled grammar file read-only. Nothing is recomputed:
+// the grammar's arrays point into the mapping, and only the name and set
+// pointer arrays are allocated. Returns false if the file is not a valid
+// compiled grammar for this build.
+bool map_grammar(Grammar *g, const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open compiled grammar '%s'\n", path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *mapping = size >= sizeof(GrammarFileHeader)
+        ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map compiled grammar '%s'\n", path);
+        return false;
+    }
+
+    const GrammarFileHeader *header = mapping;
+    const char *base = mapping;
+    uint64_t nt_count = header->non_terminal_count;
+    uint64_t t_count = header->terminal_count;
+    bool valid = memcmp(header->magic, GRAMMAR_MAGIC, sizeof(header->magic)) == 0
+        && header->version == GRAMMAR_VERSION
+        && header->byte_order == GRAMMAR_BYTE_ORDER
+        && header->file_size == size
+        && header->set_words == (t_count + 63) / 64
+        && t_count <= INT32_MAX && nt_count <= INT32_MAX
+        && header->rule_count <= INT32_MAX && header->arena_count <= INT32_MAX
+        && header->terminal_slot_count <= INT32_MAX && header->non_terminal_slot_count <= INT32_MAX
+        && section_fits(header, header->names_offset, header->names_size)
+        && section_fits(header, header->byte_map_offset, sizeof(g->terminal_of_byte))
+        && section_fits(header, header->terminal_slots_offset, header->terminal_slot_count * sizeof(int))
+        && section_fits(header, header->non_terminal_slots_offset, header->non_terminal_slot_count * sizeof(int))
+        && section_fits(header, header->rules_offset, header->rule_count * sizeof(ProductionRule))
+        && section_fits(header, header->arena_offset, header->arena_count * sizeof(Symbol))
+        && section_fits(header, header->sets_offset, nt_count * 2 * header->set_words * sizeof(uint64_t))
+        && section_fits(header, header->epsilon_offset, nt_count)
+        && section_fits(header, header->table_offset, nt_count * t_count * sizeof(TableEntry))
+        && section_fits(header, header->chain_index_offset, nt_count * t_count * sizeof(uint32_t))
+        && header->chain_count <= INT32_MAX
+        && section_fits(header, header->chain_arena_offset, header->chain_count * sizeof(int32_t))
+        && header->names_size > 0 && base[header->names_offset + header->names_size - 1] == '\0';
+    if (!valid) {
+        fprintf(stderr, "Error: '%s' is not a compatible compiled grammar (version %d expected)\n",
+                path, GRAMMAR_VERSION);
+        munmap(mapping, size);
+        return false;
+    }
+
+    grammar_init(g);
+    g->mapping = mapping;
+    g->mapping_size = size;
+
+    // Name pointers into the names section
+    const char *name = base + header->names_offset;
+    const char *names_end = name + header->names_size;
+    g->terminals.names = malloc((t_count + 1) * sizeof(char *));
+    g->non_terminals.names = malloc((nt_count + 1) * sizeof(char *));
+    for (uint64_t i = 0; i < t_count + nt_count; i++) {
+        if (name >= names_end) {
+            free_grammar(g);
+            fprintf(stderr, "Error: '%s' has a truncated name table\n", path);
+            return false;
+        }
+        if (i < t_count) {
+            g->terminals.names[i] = (char *)name;
+        } else {
+            g->non_terminals.names[i - t_count] = (char *)name;
+        }
+        name += strlen(name) + 1;
+    }
+    g->terminals.count = t_count;
+    g->non_terminals.count = nt_count;
+    g->terminals.slots = (int *)(base + header->terminal_slots_offset);
+    g->terminals.slot_count = header->terminal_slot_count;
+    g->non_terminals.slots = (int *)(base + header->non_terminal_slots_offset);
+    g->non_terminals.slot_count = header->non_terminal_slot_count;
+
+    memcpy(g->terminal_of_byte, base + header->byte_map_offset, sizeof(g->terminal_of_byte));
+    g->start_symbol = header->start_symbol;
+    g->end_marker = header->end_marker;
+    g->literal_terminal = header->literal_terminal;
+    g->rules = (ProductionRule *)(base + header->rules_offset);
+    g->rule_count = header->rule_count;
+    g->rhs_arena = (Symbol *)(base + header->arena_offset);
+    g->arena_count = header->arena_count;
+
+    // FIRST/FOLLOW sets point into the sets section
+    const uint8_t *epsilon = (const uint8_t *)(base + header->epsilon_offset);
+    g->set_words = header->set_words;
+    g->set_storage = (uint64_t *)(base + header->sets_offset);
+    g->firstFollow = malloc((nt_count + 1) * sizeof(FirstFollow));
+    for (uint64_t i = 0; i < nt_count; i++) {
+        g->firstFollow[i].first = g->set_storage + i * 2 * g->set_words;
+        g->firstFollow[i].follow = g->firstFollow[i].first + g->set_words;
+        g->firstFollow[i].first_epsilon = epsilon[i];
+    }
+
+    g->parsing_table = (TableEntry *)(base + header->table_offset);
+    g->chain_index = (uint32_t *)(base + header->chain_index_offset);
+    g->chain_arena = (int32_t *)(base + header->chain_arena_offset);
+    g->chain_count = header->chain_count;
+    if (!grammar_indices_valid(g)) {
+        free_grammar(g);
+        fprintf(stderr, "Error: '%s' has an index out of range\n", path);
+        return false;
+    }
+    g->table_id = atomic_fetch_add(&last_table_id, 1) + 1;
+    return true;
+}
+
+// Function to write the right-hand side of a production ("e" if empty).
+// Names are run together when they are all single characters, as in "+TX".
+void format_production(const Grammar *g, const ProductionRule *rule, char *buf, size_t size) {
+    size_t used = 0;
+    buf[0] = '\0';
+    if (rule->rhs_len == 0) {
+        snprintf(buf, size, "e");
+        return;
+    }
+    const Symbol *rhs = rule_rhs(g, rule);
+    for (int i = rule->rhs_len - 1; i >= 0 && used < size; i--) {
+        const char *name = symbol_name(g, rhs[i]);
+        bool spaced = i < rule->rhs_len - 1 && (strlen(name) > 1 || strlen(symbol_name(g, rhs[i + 1])) > 1);
+        used += snprintf(buf + used, size - used, "%s%s", spaced ? " " : "", name);
+    }
+}
+
+// Function to print FIRST and FOLLOW sets
+void print_first_follow(const Grammar *g) {
+    printf("\nFIRST sets:\n");
+    for (int i = 0; i < g->non_terminals.count; i++) {
+        printf("FIRST(%s) = { ", g->non_terminals.names[i]);
+        for (int j = 0; j < g->terminals.count; j++) {
+            if (set_contains(g->firstFollow[i].first, j)) printf("%s ", g->terminals.names[j]);
+        }
+        if (g->firstFollow[i].first_epsilon) printf("e ");
+        printf("}\n");
+    }
+
+    printf("\nFOLLOW sets:\n");
+    for (int i = 0; i < g->non_terminals.count; i++) {
+        printf("FOLLOW(%s) = { ", g->non_terminals.names[i]);
+        for (int j = 0; j < g->terminals.count; j++) {
+            if (set_contains(g->firstFollow[i].follow, j)) printf("%s ", g->terminals.names[j]);
+        }
+        printf("}\n");
+    }
+}
+
+// Function to print the LL(1) parsing table
+void print_parsing_table(const Grammar *g) {
+    char production[64];
+
+    printf("\nLL(1) Parsing Table:\n");
+    printf("NonTerminal\\Terminal|");
+    for (int i = 0; i < g->terminals.count; i++) {
+        printf("%6s|", g->terminals.names[i]);
+    }
+    printf("\n");
+
+    printf("---------------------");
+    for (int i = 0; i < g->terminals.count; i++) {
+        printf("-------");
+    }
+    printf("\n");
+
+    for (int i = 0; i < g->non_terminals.count; i++) {
+        printf("%10s\t    |", g->non_terminals.names[i]);
+        for (int j = 0; j < g->terminals.count; j++) {
+            TableEntry entry = table_entry(g, i, j);
+            if (entry != NO_PRODUCTION) {
+                const ProductionRule *rule = &g->rules[entry];
+                format_production(g, rule, production, sizeof(production));
+                if (rule->rhs_len == 0) {
+                    printf("%3s→e |", g->non_terminals.names[i]);
+                } else {
+                    printf("%3s→%s|", g->non_terminals.names[i], production);
+                }
+            } else {
+                printf("%6s|", "");
+            }
+        }
+        printf("\n");
+    }
+}
+
+// Function to check that a name can be used as a C identifier prefix
+static bool is_identifier(const char *name) {
+    if (!name[0] || isdigit((unsigned char)name[0])) return false;
+    for (const char *c = name; *c; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') return false;
+    }
+    return true;
+}
+
+// Function to write a symbol name or production as a C comment, unless the
+// text would end the comment early
+static void write_comment(FILE *out, const char *text) {
+    if (!strstr(text, "*/")) fprintf(out, " /* %s */", text);
+}
+
+// Function to write a standalone C parser for a compiled grammar. The parser
+// is `bool <name>_parse(const char *input)` and accepts exactly what
+// parse_input accepts. The parsing table is unrolled into code: every symbol
+// gets a label, every non-terminal a switch on the lookahead whose cases push
+// the rest of a production as constants and jump straight to its first
+// symbol, so the only table left is the byte-to-terminal map. Returns false
+// if `name` is not an identifier or the output could not be written.
+bool generate_parser(const Grammar *g, FILE *out, const char *name) {
+    if (!is_identifier(name)) {
+        fprintf(stderr, "Error: '%s' is not a valid C identifier\n", name);
+        return false;
+    }
+    int terminal_count = g->terminals.count;
+    char production[64];
+
+    // Stack entries are terminal IDs, with non-terminal n stored as
+    // terminal_count + n so the dispatch switch is dense
+    fprintf(out, "// LL(1) parser generated from a grammar with %d rules, %d non-terminals\n"
+                 "// and %d terminals. Do not edit; regenerate with ll1 --generate.\n",
+            g->rule_count, g->non_terminals.count, terminal_count);
+    fprintf(out, "#include <ctype.h>\n#include <stdbool.h>\n#include <stdio.h>\n"
+                 "#include <stdlib.h>\n#include <string.h>\n\n");
+    fprintf(out, "bool %s_parse(const char *input);\n\n", name);
+
+    fprintf(out, "// Input byte -> terminal ID, -1 if none\n");
+    fprintf(out, "static const int %s_terminal_of_byte[256] = {", name);
+    for (int i = 0; i < 256; i++) {
+        fprintf(out, "%s%d%s", i % 16 == 0 ? "\n    " : "", g->terminal_of_byte[i], i < 255 ? ", " : "\n");
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "// Function to get the terminal ID of the next input character, skipping\n"
+                 "// whitespace. The end of the string reads as the end marker.\n"
+                 "static int %s_peek(const unsigned char **p) {\n"
+                 "    while (isspace(**p)) (*p)++;\n"
+                 "    return **p ? %s_terminal_of_byte[**p] : %d;\n"
+                 "}\n\n", name, name, g->end_marker);
+
+    fprintf(out, "// Function to move the stack to the heap, or grow it there\n"
+                 "static int *%s_grow(int *stack, const int *local, size_t *capacity, size_t needed) {\n"
+                 "    size_t new_capacity = *capacity;\n"
+                 "    while (new_capacity < needed) new_capacity *= 2;\n"
+                 "    int *grown = stack == local ? malloc(new_capacity * sizeof(int))\n"
+                 "                                : realloc(stack, new_capacity * sizeof(int));\n"
+                 "    if (!grown) {\n"
+                 "        fprintf(stderr, \"Error: Out of memory\\n\");\n"
+                 "        exit(1);\n"
+                 "    }\n"
+                 "    if (stack == local) memcpy(grown, local, *capacity * sizeof(int));\n"
+                 "    *capacity = new_capacity;\n"
+                 "    return grown;\n"
+                 "}\n\n", name);
+
+    fprintf(out, "bool %s_parse(const char *input) {\n"
+                 "    int local[64];\n"
+                 "    int *stack = local;\n"
+                 "    size_t capacity = 64, top = 0;\n"
+                 "    const unsigned char *p = (const unsigned char *)input;\n"
+                 "    bool accepted = false;\n"
+                 "    int lookahead = %s_peek(&p);\n\n"
+                 "    stack[top++] = %d;\n"
+                 "    goto n%d;\n\n", name, name, g->end_marker, g->start_symbol);
+
+    fprintf(out, "dispatch:\n    switch (stack[--top]) {\n");
+    for (int t = 0; t < terminal_count; t++) fprintf(out, "    case %d: goto t%d;\n", t, t);
+    for (int n = 0; n < g->non_terminals.count; n++) {
+        fprintf(out, "    case %d: goto n%d;\n", terminal_count + n, n);
+    }
+    fprintf(out, "    default: goto done;\n    }\n\n");
+
+    // Terminals: match and advance; the end marker accepts
+    for (int t = 0; t < terminal_count; t++) {
+        fprintf(out, "t%d:", t);
+        write_comment(out, g->terminals.names[t]);
+        if (t == g->end_marker) {
+            fprintf(out, "\n    accepted = lookahead == %d;\n    goto done;\n", t);
+        } else if (t == g->literal_terminal) {
+            // A literal is the whole run of digits
+            fprintf(out, "\n    if (lookahead != %d) goto done;\n"
+                         "    if (isdigit(*p)) {\n"
+                         "        while (isdigit(*p)) p++;\n"
+                         "    } else {\n"
+                         "        p++;\n"
+                         "    }\n"
+                         "    lookahead = %s_peek(&p);\n"
+                         "    goto dispatch;\n", t, name);
+        } else {
+            fprintf(out, "\n    if (lookahead != %d) goto done;\n"
+                         "    p++;\n"
+                         "    lookahead = %s_peek(&p);\n"
+                         "    goto dispatch;\n", t, name);
+        }
+    }
+
+    // Non-terminals: one case group per production in the table row
+    for (int n = 0; n < g->non_terminals.count; n++) {
+        fprintf(out, "n%d:", n);
+        write_comment(out, g->non_terminals.names[n]);
+        fprintf(out, "\n    switch (lookahead) {\n");
+        for (int r = 0; r < g->rule_count; r++) {
+            const ProductionRule *rule = &g->rules[r];
+            if (rule->lhs != n) continue;
+            int cases = 0;
+            for (int t = 0; t < terminal_count; t++) {
+                if (table_entry(g, n, t) != r) continue;
+                fprintf(out, "%scase %d:", cases % 8 == 0 ? (cases ? "\n    " : "    ") : " ", t);
+                cases++;
+            }
+            if (cases == 0) continue;
+            format_production(g, rule, production, sizeof(production));
+            char text[sizeof(production) + 64];
+            snprintf(text, sizeof(text), "%s -> %s", g->non_terminals.names[n], production);
+            write_comment(out, text);
+            fprintf(out, "\n");
+
+            // Push all but the first symbol (already reversed), then jump to it
+            const Symbol *rhs = rule_rhs(g, rule);
+            int rest = rule->rhs_len - 1;
+            if (rest > 0) {
+                fprintf(out, "        if (top + %d > capacity) stack = %s_grow(stack, local, &capacity, top + %d);\n",
+                        rest, name, rest);
+                for (int k = 0; k < rest; k++) {
+                    Symbol s = rhs[k];
+                    fprintf(out, "        stack[top++] = %d;\n", is_terminal(s) ? s : terminal_count + NT_INDEX(s));
+                }
+            }
+            if (rule->rhs_len == 0) {
+                fprintf(out, "        goto dispatch;\n");
+            } else {
+                Symbol first = rhs[rule->rhs_len - 1];
+                fprintf(out, "        goto %c%d;\n", is_terminal(first) ? 't' : 'n',
+                        is_terminal(first) ? first : NT_INDEX(first));
+            }
+        }
+        fprintf(out, "    default: goto done;\n    }\n");
+    }
+
+    fprintf(out, "\ndone:\n"
+                 "    if (stack != local) free(stack);\n"
+                 "    return accepted;\n"
+                 "}\n");
+    fflush(out);
+    return !ferror(out);
+}
+
+// Function to print a stack bottom to top, padded to a 15-character column
+static void print_symbols(const Grammar *g, const Symbol *symbols, int count) {
+    int width = 0;
+    for (int i = 0; i < count; i++) {
+        width += printf("%s", symbol_name(g, symbols[i]));
+    }
+    printf("%*s\t", width < 15 ? 15 - width : 0, "");
+}
+
+// Function to set up a trace ring buffer holding the last `capacity` events
+void trace_init(TraceLog *log, uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity) size *= 2;
+    log->events = malloc(size * sizeof(TraceEvent));
+    log->capacity = size;
+    log->count = 0;
+}
+
+void trace_free(TraceLog *log) {
+    free(log->events);
+    log->events = NULL;
+}
+
+// Function to append one event, overwriting the oldest when the buffer is full
+static void trace_record(TraceLog *log, uint32_t step, int32_t action, uint64_t input_offset) {
+    TraceEvent *event = &log->events[log->count++ & (log->capacity - 1)];
+    event->step = step;
+    event->action = action;
+    event->input_offset = input_offset;
+}
+
+// Function to get the terminal matched at an input byte, for a trace whose
+// stack cannot be replayed: a word byte (as the lexer defines words) starts a
+// literal when the grammar has one. -1 if the byte is no terminal.
+static int matched_terminal(const Grammar *g, char c) {
+    int t = get_terminal_index(g, c);
+    if (t < 0 && g->literal_terminal >= 0 && (isalnum((unsigned char)c) || c == '_')) t = g->literal_terminal;
+    return t;
+}
+
+// Function to print the step table from a trace. The stack column is rebuilt by
+// replaying the events, so it is only shown when no events were overwritten.
+// The input column shows the rest of `input`, or just the offset when the
+// input was streamed and input is NULL.
+void render_trace(const Grammar *g, const TraceLog *log, const char *input) {
+    char production[64];
+    uint64_t first = log->count > log->capacity ? log->count - log->capacity : 0;
+    bool complete = first == 0;
+    Symbol *replay = NULL;
+    int replay_capacity = 0;
+    int replay_top = -1;
+
+    printf("\nParsing Steps:\n");
+    printf("Stack\t\tInput\t\tAction\n");
+    if (complete) {
+        replay = grow_array(replay, &replay_capacity, 2, sizeof(Symbol));
+        replay[++replay_top] = g->end_marker;
+        replay[++replay_top] = NT_SYMBOL(g->start_symbol);
+    } else {
+        printf("(%llu earlier steps not retained)\n", (unsigned long long)first);
+    }
+
+    for (uint64_t i = first; i < log->count; i++) {
+        const TraceEvent *event = &log->events[i & (log->capacity - 1)];
+
+        if (complete) {
+            print_symbols(g, replay, replay_top + 1);
+        } else {
+            printf("%-15s\t", "...");
+        }
+        int width = input ? printf("%s$", input + event->input_offset)
+                          : printf("@%llu", (unsigned long long)event->input_offset);
+        printf("%*s\t", width < 15 ? 15 - width : 0, "");
+
+        if (event->action >= 0) {
+            const ProductionRule *rule = &g->rules[event->action];
+            format_production(g, rule, production, sizeof(production));
+            printf("Apply %s -> %s\n", g->non_terminals.names[rule->lhs], production);
+            if (complete) {
+                replay = grow_array(replay, &replay_capacity, replay_top + rule->rhs_len + 1, sizeof(Symbol));
+                memcpy(replay + replay_top, rule_rhs(g, rule), rule->rhs_len * sizeof(Symbol));
+                replay_top += rule->rhs_len - 1;
+            }
+            continue;
+        }
+
+        switch (event->action) {
+            case TRACE_MATCH: {
+                int terminal = input ? matched_terminal(g, input[event->input_offset]) : -1;
+                if (complete) {
+                    printf("Match %s\n", symbol_name(g, replay[replay_top--]));
+                } else if (terminal >= 0) {
+                    printf("Match %s\n", g->terminals.names[terminal]);
+                } else {
+                    printf("Match\n");
+                }
+                break;
+            }
+            case TRACE_ACCEPT:
+                printf("Accept\n");
+                break;
+            case TRACE_INVALID_SYMBOL:
+                printf("Error: Invalid symbol\n");
+                break;
+            case TRACE_MISMATCH:
+                printf("Error: Terminal mismatch\n");
+                break;
+            case TRACE_NO_PRODUCTION:
+                printf("Error: No production in parsing table\n");
+                break;
+        }
+    }
+    free(replay);
+}
+
+// Function to read over an in-memory string; the string is not modified
+void stream_open_string(InputStream *in, const char *text) {
+    in->file = NULL;
+    in->buffer = (char *)text;
+    in->length = strlen(text);
+    in->pos = 0;
+    in->base = 0;
+}
+
+// Function to read from a file in INPUT_CHUNK-sized pieces
+void stream_open_file(InputStream *in, FILE *file) {
+    in->file = file;
+    in->buffer = malloc(INPUT_CHUNK);
+    in->length = 0;
+    in->pos = 0;
+    in->base = 0;
+}
+
+// Function to read over a byte range in place, e.g. part of a memory mapping
+void stream_open_buffer(InputStream *in, const char *data, size_t length) {
+    in->file = NULL;
+    in->buffer = (char *)data;
+    in->length = length;
+    in->pos = 0;
+    in->base = 0;
+}
+
+void stream_close(InputStream *in) {
+    if (in->file) free(in->buffer);
+    in->buffer = NULL;
+}
+
+// Function to load the next chunk; returns false at end of input
+static bool stream_refill(InputStream *in) {
+    if (!in->file) return false;
+    in->base += in->length;
+    in->length = fread(in->buffer, 1, INPUT_CHUNK, in->file);
+    in->pos = 0;
+    return in->length > 0;
+}
+
+// Function to get the terminal ID of the next input character, skipping
+// whitespace. End of input reads as the end marker, -1 is an invalid symbol.
+static int stream_peek(const Grammar *g, InputStream *in) {
+    while (true) {
+        while (in->pos < in->length) {
+            char c = in->buffer[in->pos];
+            if (!isspace((unsigned char)c)) return get_terminal_index(g, c);
+            in->pos++;
+        }
+        if (!stream_refill(in)) return g->end_marker;
+    }
+}
+
+// Function to consume a run of decimal digits, which may span chunks, and
+// get its value. Returns false if the value does not fit in an int64_t.
+static bool stream_read_number(InputStream *in, uint64_t *value) {
+    uint64_t v = 0;
+    bool in_range = true;
+    do {
+        while (in->pos < in->length) {
+            unsigned char c = in->buffer[in->pos];
+            if (!isdigit(c)) {
+                *value = v;
+                return in_range;
+            }
+            if (v > (uint64_t)(INT64_MAX - (c - '0')) / 10) in_range = false;
+            v = v * 10 + (c - '0');
+            in->pos++;
+        }
+    } while (stream_refill(in));
+    *value = v;
+    return in_range;
+}
+
+// Function to get the input offset of the next character
+uint64_t stream_offset(const InputStream *in) {
+    return in->base + in->pos;
+}
+
+// Lexer: classifies the input 64 bytes at a time into bitmasks of whitespace
+// and word bytes ([A-Za-z0-9_]), with SSE2 or AVX2 when the CPU has them, and
+// emits one token per bit that starts a token. When the grammar has a literal
+// terminal, a whole word (identifier or number) is one literal token;
+// otherwise every non-space byte is a token of its own.
+#define LEX_BLOCK 64
+
+typedef void (*ClassifyFunction)(const unsigned char *block, uint64_t *space, uint64_t *word);
+
+static void classify_scalar(const unsigned char *block, uint64_t *space, uint64_t *word) {
+    uint64_t s = 0, w = 0;
+    for (int i = 0; i < LEX_BLOCK; i++) {
+        unsigned char c = block[i];
+        s |= (uint64_t)(c == ' ' || (unsigned)(c - '\t') <= '\r' - '\t') << i;
+        w |= (uint64_t)((unsigned)((c | 0x20) - 'a') < 26 || (unsigned)(c - '0') < 10 || c == '_') << i;
+    }
+    *space = s;
+    *word = w;
+}
+
+#ifdef LL1_X86_SIMD
+// Bytes of v in [lo, hi], as 0xFF lanes: unsigned v - lo <= hi - lo
+#define SSE_IN_RANGE(v, lo, hi) \
+    _mm_cmpeq_epi8(_mm_min_epu8(_mm_sub_epi8(v, _mm_set1_epi8(lo)), _mm_set1_epi8((hi) - (lo))), \
+                   _mm_sub_epi8(v, _mm_set1_epi8(lo)))
+#define AVX_IN_RANGE(v, lo, hi) \
+    _mm256_cmpeq_epi8(_mm256_min_epu8(_mm256_sub_epi8(v, _mm256_set1_epi8(lo)), _mm256_set1_epi8((hi) - (lo))), \
+                      _mm256_sub_epi8(v, _mm256_set1_epi8(lo)))
+
+__attribute__((target("sse2")))
+static void classify_sse2(const unsigned char *block, uint64_t *space, uint64_t *word) {
+    uint64_t s = 0, w = 0;
+    for (int i = 0; i < LEX_BLOCK; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), SSE_IN_RANGE(v, '\t', '\r'));
+        __m128i letter = SSE_IN_RANGE(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+        __m128i alnum = _mm_or_si128(_mm_or_si128(letter, SSE_IN_RANGE(v, '0', '9')),
+                                     _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        s |= (uint64_t)(uint16_t)_mm_movemask_epi8(blank) << i;
+        w |= (uint64_t)(uint16_t)_mm_movemask_epi8(alnum) << i;
+    }
+    *space = s;
+    *word = w;
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const unsigned char *block, uint64_t *space, uint64_t *word) {
+    uint64_t s = 0, w = 0;
+    for (int i = 0; i < LEX_BLOCK; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), AVX_IN_RANGE(v, '\t', '\r'));
+        __m256i letter = AVX_IN_RANGE(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i alnum = _mm256_or_si256(_mm256_or_si256(letter, AVX_IN_RANGE(v, '0', '9')),
+                                        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+        s |= (uint64_t)(uint32_t)_mm256_movemask_epi8(blank) << i;
+        w |= (uint64_t)(uint32_t)_mm256_movemask_epi8(alnum) << i;
+    }
+    *space = s;
+    *word = w;
+}
+#endif
+
+// Function to pick the widest classifier this CPU supports
+static ClassifyFunction best_classifier() {
+#ifdef LL1_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) return classify_avx2;
+    if (__builtin_cpu_supports("sse2")) return classify_sse2;
+#endif
+    return classify_scalar;
+}
+
+void token_buffer_init(TokenBuffer *tokens) {
+    tokens->terminals = NULL;
+    tokens->offsets = NULL;
+    tokens->count = 0;
+    tokens->capacity = 0;
+}
+
+void token_buffer_free(TokenBuffer *tokens) {
+    free(tokens->terminals);
+    free(tokens->offsets);
+    token_buffer_init(tokens);
+}
+
+// Function to lex with a given classifier (see lex_input)
+static bool lex_with(const Grammar *g, const char *data, size_t length, TokenBuffer *tokens, ClassifyFunction classify) {
+    if (length >= INT32_MAX) {
+        fprintf(stderr, "Error: Input of %zu bytes is too large to lex\n", length);
+        return false;
+    }
+    const unsigned char *bytes = (const unsigned char *)data;
+    const bool words = g->literal_terminal >= 0;
+    uint64_t carry = 0;     // Whether the byte before the block is a word byte
+    int count = 0;
+    bool invalid = false;
+
+    for (size_t base = 0; base < length && !invalid; base += LEX_BLOCK) {
+        unsigned char padded[LEX_BLOCK];
+        const unsigned char *block = bytes + base;
+        if (length - base < LEX_BLOCK) {
+            // The last, partial block is padded with spaces
+            memset(padded, ' ', LEX_BLOCK);
+            memcpy(padded, block, length - base);
+            block = padded;
+        }
+
+        uint64_t space, word;
+        classify(block, &space, &word);
+        uint64_t starts = ~space;
+        if (words) {
+            starts &= ~(word & (word << 1 | carry));   // Not the continuation of a word
+            carry = word >> 63;
+        } else {
+            word = 0;
+        }
+
+        if (count + LEX_BLOCK + 1 > tokens->capacity) {
+            int capacity = tokens->capacity;
+            tokens->terminals = grow_array(tokens->terminals, &capacity, count + LEX_BLOCK + 1, sizeof(Symbol));
+            tokens->offsets = grow_array(tokens->offsets, &tokens->capacity, count + LEX_BLOCK + 1, sizeof(uint32_t));
+        }
+        while (starts) {
+            int i = __builtin_ctzll(starts);
+            Symbol terminal = (word >> i) & 1 ? g->literal_terminal : g->terminal_of_byte[block[i]];
+            tokens->terminals[count] = terminal;
+            tokens->offsets[count++] = base + i;
+            if (terminal == -1) {
+                invalid = true;   // The parser stops here anyway
+                break;
+            }
+            starts &= starts - 1;
+        }
+    }
+
+    if (count + 1 > tokens->capacity) {
+        int capacity = tokens->capacity;
+        tokens->terminals = grow_array(tokens->terminals, &capacity, count + 1, sizeof(Symbol));
+        tokens->offsets = grow_array(tokens->offsets, &tokens->capacity, count + 1, sizeof(uint32_t));
+    }
+    tokens->terminals[count] = g->end_marker;
+    tokens->offsets[count++] = length;
+    tokens->count = count;
+    return true;
+}
+
+// Function to turn an input into tokens: one terminal ID and source offset
+// per token, ending with the end marker. An invalid byte becomes a -1 token
+// and ends the tokens early. Returns false if the input is 2 GiB or larger.
+bool lex_input(const Grammar *g, const char *data, size_t length, TokenBuffer *tokens) {
+    return lex_with(g, data, length, tokens, best_classifier());
+}
+
+// Function to set up a parse context for a compiled grammar
+void parse_context_init(ParseContext *ctx, const Grammar *g) {
+    ctx->grammar = g;
+    ctx->stack = NULL;
+    ctx->stack_capacity = 0;
+    ctx->top = -1;
+    ctx->node_stack = NULL;
+    ctx->node_capacity = 0;
+    ctx->values = NULL;
+    ctx->value_capacity = 0;
+    ctx->value_count = 0;
+}
+
+void parse_context_free(ParseContext *ctx) {
+    free(ctx->stack);
+    free(ctx->node_stack);
+    free(ctx->values);
+    ctx->stack = NULL;
+    ctx->stack_capacity = 0;
+    ctx->node_stack = NULL;
+    ctx->node_capacity = 0;
+    ctx->values = NULL;
+    ctx->value_capacity = 0;
+}
+
+// Function to push a value for the evaluator
+static void push_value(ParseContext *ctx, int64_t value) {
+    if (ctx->value_count >= ctx->value_capacity) {
+        ctx->values = grow_array(ctx->values, &ctx->value_capacity, ctx->value_count + 1, sizeof(int64_t));
+    }
+    ctx->values[ctx->value_count++] = value;
+}
+
+// Function to run a semantic action on the value stack. Arithmetic is done on
+// unsigned values so that overflow wraps around instead of being undefined.
+static EvalStatus apply_action(ParseContext *ctx, int action) {
+    int operands = action == ACTION_NEG ? 1 : 2;
+    if (ctx->value_count < operands) return EVAL_NO_VALUE;
+    int64_t *top = &ctx->values[ctx->value_count - operands];
+    uint64_t a = (uint64_t)top[0];
+    uint64_t b = operands == 2 ? (uint64_t)top[1] : 0;
+
+    switch (action) {
+    case ACTION_ADD: top[0] = (int64_t)(a + b); break;
+    case ACTION_SUB: top[0] = (int64_t)(a - b); break;
+    case ACTION_MUL: top[0] = (int64_t)(a * b); break;
+    case ACTION_DIV:
+    case ACTION_MOD:
+        if (b == 0) return EVAL_DIVIDE_BY_ZERO;
+        if (top[1] == -1) {
+            // INT64_MIN / -1 overflows; negate (wrapping) instead
+            top[0] = action == ACTION_DIV ? (int64_t)(0 - a) : 0;
+        } else {
+            top[0] = action == ACTION_DIV ? top[0] / top[1] : top[0] % top[1];
+        }
+        break;
+    case ACTION_NEG: top[0] = (int64_t)(0 - a); break;
+    }
+    ctx->value_count -= operands - 1;
+    return EVAL_OK;
+}
+
+// Function to set up an empty parse tree
+void parse_tree_init(ParseTree *tree) {
+    tree->nodes = NULL;
+    tree->count = 0;
+    tree->capacity = 0;
+}
+
+void parse_tree_free(ParseTree *tree) {
+    free(tree->nodes);
+    parse_tree_init(tree);
+}
+
+// Function to take `count` contiguous nodes from the tree's arena
+static uint32_t tree_alloc(ParseTree *tree, int count) {
+    if (tree->count + count > tree->capacity) {
+        tree->nodes = grow_array(tree->nodes, &tree->capacity, tree->count + count, sizeof(ParseNode));
+    }
+    uint32_t first = tree->count;
+    tree->count += count;
+    return first;
+}
+
+// Function to get the input offset of the current token or character
+static ALWAYS_INLINE uint64_t input_offset(const InputStream *in, const TokenBuffer *tokens, int next) {
+    return tokens ? tokens->offsets[next] : stream_offset(in);
+}
+
+// Function to make room for one more checkpoint, keeping the ones after the
+// gap at the end of the array
+static void reserve_checkpoint(IncrementalParse *inc) {
+    if (inc->before + inc->after < inc->checkpoint_capacity) return;
+    int old_capacity = inc->checkpoint_capacity;
+    inc->checkpoints = grow_array(inc->checkpoints, &inc->checkpoint_capacity, old_capacity + 1, sizeof(Checkpoint));
+    memmove(inc->checkpoints + inc->checkpoint_capacity - inc->after, inc->checkpoints + old_capacity - inc->after,
+            inc->after * sizeof(Checkpoint));
+}
+
+// Function to record the current parse stack as a checkpoint before the gap
+static void add_checkpoint(IncrementalParse *inc, uint64_t offset) {
+    const ParseContext *ctx = &inc->ctx;
+    int depth = ctx->top + 1;
+    reserve_checkpoint(inc);
+    inc->snapshots = grow_array(inc->snapshots, &inc->snapshot_capacity, inc->snapshot_count + depth, sizeof(Symbol));
+    memcpy(inc->snapshots + inc->snapshot_count, ctx->stack, depth * sizeof(Symbol));
+    Checkpoint *checkpoint = &inc->checkpoints[inc->before++];
+    checkpoint->offset = offset;
+    checkpoint->stack_start = inc->snapshot_count;
+    checkpoint->depth = depth;
+    inc->snapshot_count += depth;
+}
+
+// Function to drop the first checkpoint after the gap
+static void drop_checkpoint_after_gap(IncrementalParse *inc) {
+    inc->snapshot_garbage += inc->checkpoints[inc->checkpoint_capacity - inc->after].depth;
+    inc->after--;
+}
+
+// Function to run at every token boundary of an incremental parse. Returns
+// true when the parse has re-synchronized: it is at a checkpoint of the
+// previous parse, after the edit, with the same stack, so the rest of the
+// parse would repeat the previous one. Checkpoints of the previous parse that
+// it passes are dropped, and a new one is taken every CHECKPOINT_SPACING bytes.
+// Re-synchronizing adopts the previous result, or acceptance for checkpoints
+// kept from before it (see incremental_reparse).
+static bool incremental_step(IncrementalParse *inc, const InputStream *in) {
+    const ParseContext *ctx = &inc->ctx;
+    uint64_t offset = stream_offset(in);
+    while (inc->after > 0) {
+        const Checkpoint *old = &inc->checkpoints[inc->checkpoint_capacity - inc->after];
+        uint64_t old_offset = inc->length - old->offset;
+        if (old_offset > offset) break;
+        if (old_offset == offset && old->depth == ctx->top + 1
+            && memcmp(inc->snapshots + old->stack_start, ctx->stack, old->depth * sizeof(Symbol)) == 0) {
+            // Past where the previous parse stopped, checkpoints come from an
+            // earlier parse that went on to accept
+            if (old->offset < inc->stop_from_end) {
+                inc->accepted = true;
+                inc->stop_from_end = 0;
+            }
+            return true;
+        }
+        drop_checkpoint_after_gap(inc);
+    }
+    uint64_t last = inc->before ? inc->checkpoints[inc->before - 1].offset : 0;
+    if (offset >= last + CHECKPOINT_SPACING) add_checkpoint(inc, offset);
+    return false;
+}
+
+// Where a segment of a parallel parse ends: the first token boundary at or
+// past `offset`. The parse stops there and leaves its stack as it is.
+typedef struct {
+    uint64_t offset;
+    bool reached;
+} SegmentEnd;
+
+// Function to parse an input stream using the parsing table, or the tokens of
+// a lexed input instead when `tokens` is given. Every step is recorded in
+// `trace` when one is given; with NULL nothing is formatted or stored, and
+// the loop only does table lookups and stack copies. A non-terminal is
+// replaced by its whole expansion chain at once, and each production of the
+// chain is still traced as its own step. When a tree is given, the derivation
+// is built into it (see ParseTree), one production at a time. The end of
+// the stream acts as '$', and the stream is left at the point where parsing
+// stopped. When `eval` is given, productions are expanded one at a time with
+// their action symbols, literals push their values and actions run as they
+// are popped; a failed action stops the parse and is reported in *eval. When `profile` is given,
+// table cells, matches, steps and stack depth are counted into it. When `inc`
+// is given, the stack is already loaded from a checkpoint, every token
+// boundary is passed to incremental_step, and the loop stops early if that
+// reports a re-synchronized parse. When `segment` is given, the stack is
+// already loaded too, and the loop stops, returning false, once the stream
+// reaches the segment's end. `packed` tells which table layout the grammar
+// has. Inlined into every entry point, so parse_stream compiles without the
+// tree, evaluation, profiling, checkpoint and segment code.
+static ALWAYS_INLINE bool parse_loop(ParseContext *ctx, InputStream *in, const TokenBuffer *tokens, TraceLog *trace,
+                                     ParseTree *tree, EvalStatus *eval, ParseProfile *profile,
+                                     IncrementalParse *inc, SegmentEnd *segment, bool packed) {
+    const Grammar *g = ctx->grammar;
+    const int literal = g->literal_terminal;
+    uint32_t step = 0;
+
+    // Initialize stack with $ and start symbol
+    if (!inc && !segment) {
+        ctx->top = -1;
+        push(ctx, g->end_marker);
+        push(ctx, NT_SYMBOL(g->start_symbol));
+    }
+
+    int next = 0;   // Index of the current token when parsing tokens
+    int current_input = tokens ? tokens->terminals[0] : stream_peek(g, in);
+
+    // The node stack runs parallel to the symbol stack: the tree node of
+    // each stacked symbol ($ has none)
+    if (tree) {
+        tree->count = 0;
+        tree_alloc(tree, 1);
+        ParseNode *root = &tree->nodes[0];
+        root->symbol = NT_SYMBOL(g->start_symbol);
+        root->production = -1;
+        root->first_child = 0;
+        root->child_count = 0;
+        root->input_offset = input_offset(in, tokens, next);
+        ctx->node_stack = grow_array(ctx->node_stack, &ctx->node_capacity, ctx->stack_capacity, sizeof(uint32_t));
+        ctx->node_stack[0] = UINT32_MAX;
+        ctx->node_stack[1] = 0;
+    }
+
+    while (ctx->top >= 0) {
+        Symbol stack_top = peek(ctx);
+
+        if (current_input == -1) {
+            if (trace) trace_record(trace, step, TRACE_INVALID_SYMBOL, input_offset(in, tokens, next));
+            return false;
+        }
+
+        if (stack_top == current_input) {
+            // Match found
+            if (profile) profile->terminal_matches[stack_top]++;
+            if (stack_top == g->end_marker) {
+                if (trace) trace_record(trace, step, TRACE_ACCEPT, input_offset(in, tokens, next));
+                return true;
+            }
+            if (trace) trace_record(trace, step, TRACE_MATCH, input_offset(in, tokens, next));
+            if (tree) tree->nodes[ctx->node_stack[ctx->top]].input_offset = input_offset(in, tokens, next);
+            pop(ctx);
+            if (tokens) {
+                current_input = tokens->terminals[++next];
+            } else {
+                if (stack_top == literal && (unsigned char)(in->buffer[in->pos] - '0') < 10) {
+                    // A literal is the whole run of digits
+                    uint64_t value;
+                    bool in_range = stream_read_number(in, &value);
+                    if (eval) {
+                        if (!in_range) {
+                            *eval = EVAL_OUT_OF_RANGE;
+                            return false;
+                        }
+                        push_value(ctx, (int64_t)value);
+                    }
+                } else {
+                    if (eval && stack_top == literal) {
+                        *eval = EVAL_NO_VALUE;
+                        return false;
+                    }
+                    in->pos++;
+                }
+                current_input = stream_peek(g, in);
+                if (inc && incremental_step(inc, in)) {
+                    inc->resynced = true;
+                    return inc->accepted;
+                }
+                if (segment && stream_offset(in) >= segment->offset) {
+                    segment->reached = true;
+                    return false;
+                }
+            }
+        }
+        else if (is_terminal(stack_top)) {
+            if (eval && is_action(stack_top)) {
+                // Actions are not parse steps and are not traced
+                pop(ctx);
+                *eval = apply_action(ctx, stack_top - ACTION_BASE);
+                if (*eval != EVAL_OK) return false;
+                continue;
+            }
+            if (trace) trace_record(trace, step, TRACE_MISMATCH, input_offset(in, tokens, next));
+            return false;
+        }
+        else if (!tree && !eval) {
+            // Non-terminal on stack - apply its whole expansion chain for
+            // this lookahead, pushing what the chain leaves in one copy
+            uint32_t chain = lookup_chain(g, NT_INDEX(stack_top), current_input, packed);
+            if (chain == CHAIN_NONE) {
+                if (trace) trace_record(trace, step, TRACE_NO_PRODUCTION, input_offset(in, tokens, next));
+                return false;
+            }
+            const int32_t *record = g->chain_arena + chain;
+            int steps = record[0];
+            int push_len = record[1];
+            const int32_t *productions = record + CHAIN_HEADER;
+            if (trace) {
+                uint64_t offset = input_offset(in, tokens, next);
+                for (int k = 0; k < steps; k++) trace_record(trace, step + k, productions[k], offset);
+            }
+            if (profile) {
+                for (int k = 0; k < steps; k++) {
+                    profile->cell_hits[(size_t)g->rules[productions[k]].lhs * g->terminals.count + current_input]++;
+                }
+                if (ctx->top + record[2] > profile->max_depth) profile->max_depth = ctx->top + record[2];
+                profile->steps += steps - 1;
+            }
+
+            pop(ctx);
+            if (ctx->top + push_len >= ctx->stack_capacity) {
+                ctx->stack = grow_array(ctx->stack, &ctx->stack_capacity,
+                                        ctx->top + push_len + 1, sizeof(Symbol));
+            }
+            memcpy(ctx->stack + ctx->top + 1, productions + steps, push_len * sizeof(Symbol));
+            ctx->top += push_len;
+            step += steps - 1;
+        }
+        else {
+            // Non-terminal on stack, building a tree or evaluating - expand
+            // one production at a time
+            TableEntry entry = lookup_entry(g, NT_INDEX(stack_top), current_input, packed);
+            if (entry == NO_PRODUCTION) {
+                if (trace) trace_record(trace, step, TRACE_NO_PRODUCTION, input_offset(in, tokens, next));
+                return false;
+            }
+            if (profile) profile->cell_hits[(size_t)NT_INDEX(stack_top) * g->terminals.count + current_input]++;
+            const ProductionRule *rule = &g->rules[entry];
+            const Symbol *rhs = rule_rhs(g, rule);
+            int push_len = eval ? rule->eval_len : rule->rhs_len;
+            if (trace) trace_record(trace, step, entry, input_offset(in, tokens, next));
+
+            pop(ctx);  // Remove non-terminal from stack
+
+            // Push the pre-reversed production in one copy (nothing for epsilon)
+            if (ctx->top + push_len >= ctx->stack_capacity) {
+                ctx->stack = grow_array(ctx->stack, &ctx->stack_capacity,
+                                        ctx->top + push_len + 1, sizeof(Symbol));
+            }
+            memcpy(ctx->stack + ctx->top + 1, eval ? g->rhs_arena + rule->eval_start : rhs,
+                   push_len * sizeof(Symbol));
+
+            // The children are allocated together, in grammar order, and
+            // stacked in reverse like their symbols
+            if (tree) {
+                uint32_t parent = ctx->node_stack[ctx->top + 1];
+                uint32_t first = tree_alloc(tree, rule->rhs_len);
+                tree->nodes[parent].production = entry;
+                tree->nodes[parent].first_child = first;
+                tree->nodes[parent].child_count = rule->rhs_len;
+                if (ctx->node_capacity < ctx->stack_capacity) {
+                    ctx->node_stack = grow_array(ctx->node_stack, &ctx->node_capacity,
+                                                 ctx->stack_capacity, sizeof(uint32_t));
+                }
+                for (int k = 0; k < rule->rhs_len; k++) {
+                    ParseNode *child = &tree->nodes[first + k];
+                    child->symbol = rhs[rule->rhs_len - 1 - k];
+                    child->production = -1;
+                    child->first_child = 0;
+                    child->child_count = 0;
+                    child->input_offset = input_offset(in, tokens, next);
+                    ctx->node_stack[ctx->top + rule->rhs_len - k] = first + k;
+                }
+            }
+            ctx->top += push_len;
+            if (profile && ctx->top + 1 > profile->max_depth) profile->max_depth = ctx->top + 1;
+        }
+        step++;
+        if (profile) profile->steps++;
+    }
+
+    return false;
+}
+
+// Function to run one parse with the loop specialized to the grammar's table
+// layout, counting it into the calling thread's profile when profiling is
+// compiled in
+static ALWAYS_INLINE bool run_parse(ParseContext *ctx, InputStream *in, const TokenBuffer *tokens,
+                                    TraceLog *trace, ParseTree *tree, EvalStatus *eval, IncrementalParse *inc) {
+    bool packed = ctx->grammar->row_base != NULL;
+#ifdef LL1_PROFILE
+    ParseProfile *profile = thread_profile(ctx->grammar);
+    uint64_t steps_before = profile->steps;
+    double started = profile_clock();
+    bool accepted = packed ? parse_loop(ctx, in, tokens, trace, tree, eval, profile, inc, NULL, true)
+                           : parse_loop(ctx, in, tokens, trace, tree, eval, profile, inc, NULL, false);
+    profile_input(profile, accepted, profile->steps - steps_before, profile_clock() - started);
+    return accepted;
+#else
+    return packed ? parse_loop(ctx, in, tokens, trace, tree, eval, NULL, inc, NULL, true)
+                  : parse_loop(ctx, in, tokens, trace, tree, eval, NULL, inc, NULL, false);
+#endif
+}
+
+// Function to parse one segment of a parallel parse from the stack already in
+// `ctx`, up to the segment's end. Segments are not counted in profiles.
+static bool parse_segment(ParseContext *ctx, InputStream *in, SegmentEnd *segment) {
+    return ctx->grammar->row_base ? parse_loop(ctx, in, NULL, NULL, NULL, NULL, NULL, NULL, segment, true)
+                                  : parse_loop(ctx, in, NULL, NULL, NULL, NULL, NULL, NULL, segment, false);
+}
+
+// Function to parse the tokens produced by lex_input
+bool parse_tokens(ParseContext *ctx, const TokenBuffer *tokens, TraceLog *trace) {
+    return run_parse(ctx, NULL, tokens, trace, NULL, NULL, NULL);
+}
+
+// Function to parse an input stream, reporting only whether it is accepted
+bool parse_stream(ParseContext *ctx, InputStream *in, TraceLog *trace) {
+    return run_parse(ctx, in, NULL, trace, NULL, NULL, NULL);
+}
+
+// Function to parse an input stream and build its parse tree
+bool parse_stream_tree(ParseContext *ctx, InputStream *in, TraceLog *trace, ParseTree *tree) {
+    return run_parse(ctx, in, NULL, trace, tree, NULL, NULL);
+}
+
+// Function to parse input string using the parsing table; the end of the
+// string marks the end of input, and the string itself is left unchanged
+bool parse_input(ParseContext *ctx, const char *input, TraceLog *trace) {
+    InputStream in;
+    stream_open_string(&in, input);
+    return parse_stream(ctx, &in, trace);
+}
+
+// Function to parse an input string and build its parse tree
+bool parse_input_tree(ParseContext *ctx, const char *input, TraceLog *trace, ParseTree *tree) {
+    InputStream in;
+    stream_open_string(&in, input);
+    return parse_stream_tree(ctx, &in, trace, tree);
+}
+
+// Function to parse an input stream and evaluate it in the same pass
+EvalStatus evaluate_stream(ParseContext *ctx, InputStream *in, TraceLog *trace, int64_t *result) {
+    EvalStatus status = EVAL_OK;
+    ctx->value_count = 0;
+    if (!run_parse(ctx, in, NULL, trace, NULL, &status, NULL)) return status == EVAL_OK ? EVAL_REJECTED : status;
+    if (ctx->value_count == 0) return EVAL_NO_VALUE;
+    *result = ctx->values[ctx->value_count - 1];
+    return EVAL_OK;
+}
+
+// Function to parse an input string and evaluate it in the same pass
+EvalStatus evaluate_input(ParseContext *ctx, const char *input, TraceLog *trace, int64_t *result) {
+    InputStream in;
+    stream_open_string(&in, input);
+    return evaluate_stream(ctx, &in, trace, result);
+}
+
+// Function to set up incremental parsing with a grammar
+void incremental_init(IncrementalParse *inc, const Grammar *g) {
+    memset(inc, 0, sizeof(*inc));
+    parse_context_init(&inc->ctx, g);
+}
+
+void incremental_free(IncrementalParse *inc) {
+    parse_context_free(&inc->ctx);
+    free(inc->checkpoints);
+    free(inc->snapshots);
+    memset(inc, 0, sizeof(*inc));
+}
+
+// Function to copy the live checkpoint stacks into a fresh array once most of
+// the old one belongs to dropped checkpoints
+static void compact_snapshots(IncrementalParse *inc) {
+    if (inc->snapshot_garbage * 2 <= inc->snapshot_count) return;
+    int live = inc->snapshot_count - inc->snapshot_garbage;
+    Symbol *snapshots = malloc((live + 1) * sizeof(Symbol));
+    int filled = 0;
+    for (int i = 0; i < inc->checkpoint_capacity; i++) {
+        if (i >= inc->before && i < inc->checkpoint_capacity - inc->after) continue;
+        Checkpoint *checkpoint = &inc->checkpoints[i];
+        memcpy(snapshots + filled, inc->snapshots + checkpoint->stack_start, checkpoint->depth * sizeof(Symbol));
+        checkpoint->stack_start = filled;
+        filled += checkpoint->depth;
+    }
+    free(inc->snapshots);
+    inc->snapshots = snapshots;
+    inc->snapshot_capacity = live + 1;
+    inc->snapshot_count = filled;
+    inc->snapshot_garbage = 0;
+}
+
+// Function to parse a whole input, replacing all earlier checkpoints
+bool incremental_parse(IncrementalParse *inc, const char *text, size_t length) {
+    inc->before = 0;
+    inc->after = 0;
+    inc->snapshot_count = 0;
+    inc->snapshot_garbage = 0;
+    inc->length = length;
+    return incremental_reparse(inc, text, length, 0, length, length);
+}
+
+// Function to reparse an edited input (see incremental_parse). The work done
+// is the distance from the checkpoint before the edit to the point where the
+// parse re-synchronizes or stops, plus moving the gap from the previous edit.
+// Checkpoints up to where the last parse stopped lead to its result. When a
+// parse is rejected, the later checkpoints of the parse before it are kept if
+// that one was accepted, so that undoing the error re-synchronizes with them.
+// An edit that does not fit the previous input is reparsed from the start.
+bool incremental_reparse(IncrementalParse *inc, const char *text, size_t length,
+                         size_t edit_start, size_t old_end, size_t new_end) {
+    uint64_t old_length = inc->length;
+    if (edit_start > old_end || edit_start > new_end || old_end > old_length || new_end > length
+        || length - new_end != old_length - old_end) {
+        return incremental_parse(inc, text, length);
+    }
+
+    // Move the gap to the edit. Checkpoints at or after its start are moved
+    // after the gap: the byte at a checkpoint may now extend the token before it.
+    while (inc->before > 0 && inc->checkpoints[inc->before - 1].offset >= edit_start) {
+        Checkpoint checkpoint = inc->checkpoints[--inc->before];
+        checkpoint.offset = old_length - checkpoint.offset;
+        inc->checkpoints[inc->checkpoint_capacity - ++inc->after] = checkpoint;
+    }
+    while (inc->after > 0) {
+        Checkpoint checkpoint = inc->checkpoints[inc->checkpoint_capacity - inc->after];
+        if (old_length - checkpoint.offset >= edit_start) break;
+        checkpoint.offset = old_length - checkpoint.offset;
+        inc->after--;
+        inc->checkpoints[inc->before++] = checkpoint;
+    }
+    // Checkpoints inside the replaced bytes no longer exist
+    while (inc->after > 0 && old_length - inc->checkpoints[inc->checkpoint_capacity - inc->after].offset < old_end) {
+        drop_checkpoint_after_gap(inc);
+    }
+    inc->length = length;
+    inc->scanned = 0;
+
+    // An edit after the point where the last parse was rejected leaves the
+    // rejection as it was, but the kept checkpoints before the edit no longer
+    // lead to acceptance
+    uint64_t stop = old_length - inc->stop_from_end;
+    if (edit_start > stop) {
+        while (inc->before > 0 && inc->checkpoints[inc->before - 1].offset > stop) {
+            inc->snapshot_garbage += inc->checkpoints[--inc->before].depth;
+        }
+        inc->stop_from_end = length - stop;
+        return inc->accepted;
+    }
+    compact_snapshots(inc);
+
+    // Resume from the last checkpoint before the edit, or from the start
+    ParseContext *ctx = &inc->ctx;
+    InputStream in;
+    stream_open_buffer(&in, text, length);
+    if (inc->before > 0) {
+        const Checkpoint *checkpoint = &inc->checkpoints[inc->before - 1];
+        ctx->stack = grow_array(ctx->stack, &ctx->stack_capacity, checkpoint->depth, sizeof(Symbol));
+        memcpy(ctx->stack, inc->snapshots + checkpoint->stack_start, checkpoint->depth * sizeof(Symbol));
+        ctx->top = checkpoint->depth - 1;
+        in.pos = checkpoint->offset;
+    } else {
+        ctx->top = -1;
+        push(ctx, ctx->grammar->end_marker);
+        push(ctx, NT_SYMBOL(ctx->grammar->start_symbol));
+    }
+    uint64_t resumed = in.pos;
+    bool was_accepted = inc->accepted;
+    uint64_t old_stop_from_end = inc->stop_from_end;
+
+    inc->resynced = false;
+    bool accepted = run_parse(ctx, &in, NULL, NULL, NULL, NULL, inc);
+    inc->scanned = stream_offset(&in) - resumed;
+    if (!inc->resynced) {
+        // Checkpoints not reached are kept only if they lead to acceptance.
+        // The ones up to the previous stop lead to the previous result.
+        while (!was_accepted && inc->after > 0
+               && inc->checkpoints[inc->checkpoint_capacity - inc->after].offset >= old_stop_from_end) {
+            drop_checkpoint_after_gap(inc);
+        }
+        inc->accepted = accepted;
+        inc->stop_from_end = length - stream_offset(&in);
+    }
+    return inc->accepted;
+}
+
+// Function to get where the last incremental parse stopped
+uint64_t incremental_stop_offset(const IncrementalParse *inc) {
+    return inc->length - inc->stop_from_end;
+}
+
+// Function to describe an evaluation outcome
+const char *eval_status_message(EvalStatus status) {
+    switch (status) {
+    case EVAL_OK: return "ok";
+    case EVAL_REJECTED: return "rejected by the grammar";
+    case EVAL_NO_VALUE: return "missing value";
+    case EVAL_OUT_OF_RANGE: return "literal out of range";
+    case EVAL_DIVIDE_BY_ZERO: return "division by zero";
+    }
+    return "unknown";
+}
+
+// Function to write a parse tree in bracketed form, e.g. for "i+i":
+//     E(T(F(i) Y()) X(+ T(F(i) Y()) X()))
+// A non-terminal is followed by its children in parentheses (empty for an
+// ε-production); one that was never expanded, because the parse stopped
+// first, is written without them. The tree is walked with an explicit stack,
+// so deeply nested input does not recurse.
+void write_parse_tree(const Grammar *g, const ParseTree *tree, FILE *out) {
+    if (tree->count == 0) return;
+    const uint32_t close = UINT32_MAX;   // Stack marker for a closing parenthesis
+    uint32_t *stack = NULL;
+    int capacity = 0, top = 0;
+    bool need_space = false;
+
+    stack = grow_array(stack, &capacity, 1, sizeof(uint32_t));
+    stack[top++] = 0;
+    while (top > 0) {
+        uint32_t index = stack[--top];
+        if (index == close) {
+            fputc(')', out);
+            need_space = true;
+            continue;
+        }
+        const ParseNode *node = &tree->nodes[index];
+        if (need_space) fputc(' ', out);
+        fputs(symbol_name(g, node->symbol), out);
+        need_space = true;
+        if (node->production < 0) continue;
+
+        fputc('(', out);
+        need_space = false;
+        stack = grow_array(stack, &capacity, top + node->child_count + 1, sizeof(uint32_t));
+        stack[top++] = close;
+        for (uint32_t k = node->child_count; k > 0; k--) stack[top++] = node->first_child + k - 1;
+    }
+    fputc('\n', out);
+    free(stack);
+}
+
+// One batch validation task: a run of whole lines
+typedef struct {
+    const char *start;
+    size_t length;
+    uint64_t line_count;        // Lines in the chunk
+    uint64_t *failed;           // Chunk-relative indices of rejected lines
+    int failed_count;
+    int failed_capacity;
+} LineChunk;
+
+typedef struct {
+    LineChunk *chunks;
+    ParseContext *contexts;     // One per worker
+} BatchJob;
+
+static void validate_chunk(void *arg, int task, int worker) {
+    BatchJob *job = arg;
+    LineChunk *chunk = &job->chunks[task];
+    ParseContext *ctx = &job->contexts[worker];
+    const char *p = chunk->start;
+    const char *end = p + chunk->length;
+    InputStream in;
+
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        const char *line_end = newline ? newline : end;
+
+        stream_open_buffer(&in, p, line_end - p);
+        if (!parse_stream(ctx, &in, NULL)) {
+            chunk->failed = grow_array(chunk->failed, &chunk->failed_capacity,
+                                       chunk->failed_count + 1, sizeof(uint64_t));
+            chunk->failed[chunk->failed_count++] = chunk->line_count;
+        }
+        chunk->line_count++;
+        p = newline ? newline + 1 : end;
+    }
+}
+
+// Function to validate every line of a buffer. The buffer is cut into chunks
+// of about BATCH_CHUNK bytes at line boundaries; workers parse the chunks in
+// place, and line numbers are assigned afterwards from the per-chunk counts.
+void validate_lines(const Grammar *g, const char *data, size_t length, int threads, BatchResult *result) {
+    if (threads <= 0) threads = default_thread_count();
+
+    // Cut at line boundaries; smaller chunks for small inputs keep every worker busy
+    size_t target = length / ((size_t)threads * 8) + 1;
+    if (target > BATCH_CHUNK) target = BATCH_CHUNK;
+    LineChunk *chunks = NULL;
+    int chunk_count = 0;
+    int chunk_capacity = 0;
+    for (size_t pos = 0; pos < length;) {
+        size_t end = pos + target < length ? pos + target : length;
+        const char *newline = end < length ? memchr(data + end, '\n', length - end) : NULL;
+        end = newline ? (size_t)(newline - data) + 1 : length;
+
+        chunks = grow_array(chunks, &chunk_capacity, chunk_count + 1, sizeof(LineChunk));
+        memset(&chunks[chunk_count], 0, sizeof(LineChunk));
+        chunks[chunk_count].start = data + pos;
+        chunks[chunk_count].length = end - pos;
+        chunk_count++;
+        pos = end;
+    }
+
+    BatchJob job = {chunks, malloc(threads * sizeof(ParseContext))};
+    for (int w = 0; w < threads; w++) parse_context_init(&job.contexts[w], g);
+    run_parallel(threads, chunk_count, validate_chunk, &job);
+    for (int w = 0; w < threads; w++) parse_context_free(&job.contexts[w]);
+    free(job.contexts);
+
+    // Stitch the per-chunk results together in file order
+    result->line_count = 0;
+    result->failed_count = 0;
+    for (int c = 0; c < chunk_count; c++) result->failed_count += chunks[c].failed_count;
+    result->failed_lines = malloc((result->failed_count + 1) * sizeof(uint64_t));
+    uint64_t filled = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        for (int i = 0; i < chunks[c].failed_count; i++) {
+            result->failed_lines[filled++] = result->line_count + chunks[c].failed[i] + 1;
+        }
+        result->line_count += chunks[c].line_count;
+        free(chunks[c].failed);
+    }
+    free(chunks);
+}
+
+void batch_result_free(BatchResult *result) {
+    free(result->failed_lines);
+    result->failed_lines = NULL;
+}
+
+// Parallel parsing of one long input. Each thread gets a chunk of the input
+// and counts its net parenthesis depth; a prefix sum over the chunks gives
+// the depth at each chunk's start, and each chunk but the first is split at
+// its first operator outside all parentheses. The segments between splits are
+// parsed concurrently, each from the stack the grammar implies right after
+// its operator. That stack is guessed by a probe parse of the operator behind
+// a one-symbol operand, e.g. "i+" leaves $ X T. The segments are then
+// stitched in order: a segment's result stands when the one before it ended
+// with exactly its starting stack, and otherwise it is parsed again from the
+// stack it actually follows, so the result is always the sequential one.
+typedef struct {
+    Symbol *stacks;             // Guessed stacks, bottom first, back to back
+    int start[256];             // Where each byte's guess starts in stacks, -1 if none
+    int depth[256];
+} BoundaryGuesses;
+
+typedef struct {
+    uint64_t start;             // Input offset just after the operator it follows
+    const Symbol *guess;        // Stack it is parsed from
+    int guess_depth;
+    SegmentEnd end;
+    ParseContext ctx;
+    bool accepted;
+    uint64_t stop_offset;
+} Segment;
+
+typedef struct {
+    const char *data;
+    size_t length;
+    int chunk_count;
+    const BoundaryGuesses *guesses;
+    int64_t *depths;            // Net depth change of each chunk, then depth at its start
+    uint64_t *splits;           // Operator position chosen in each chunk, or UINT64_MAX
+    Segment *segments;
+} ParallelJob;
+
+// Function to load a stack into a context, bottom first
+static void load_stack(ParseContext *ctx, const Symbol *stack, int depth) {
+    if (depth > ctx->stack_capacity) ctx->stack = grow_array(ctx->stack, &ctx->stack_capacity, depth, sizeof(Symbol));
+    memcpy(ctx->stack, stack, depth * sizeof(Symbol));
+    ctx->top = depth - 1;
+}
+
+// Function to guess the stack after each operator byte outside parentheses:
+// the stack after parsing the operator behind the first single-byte operand
+// that leads to it. Bytes with no such operand are never split at, and
+// neither are digits when they can continue a literal.
+static void probe_boundary_guesses(const Grammar *g, BoundaryGuesses *guesses) {
+    unsigned char candidates[256];
+    int candidate_count = 0;
+    for (int c = 0; c < 256; c++) {
+        guesses->start[c] = -1;
+        int t = get_terminal_index(g, (char)c);
+        if (c && t >= 0 && t != g->end_marker && c != '(' && c != ')' && !isspace(c)) candidates[candidate_count++] = c;
+    }
+
+    ParseContext ctx;
+    parse_context_init(&ctx, g);
+    const Symbol start[2] = {g->end_marker, NT_SYMBOL(g->start_symbol)};
+    int used = 0, capacity = 0;
+    guesses->stacks = NULL;
+    for (int i = 0; i < candidate_count; i++) {
+        if (g->literal_terminal >= 0 && isdigit(candidates[i])) continue;
+        for (int j = 0; j < candidate_count; j++) {
+            char probe[3] = {candidates[j], candidates[i], '\0'};
+            InputStream in;
+            stream_open_buffer(&in, probe, 2);
+            SegmentEnd end = {2, false};
+            load_stack(&ctx, start, 2);
+            parse_segment(&ctx, &in, &end);
+            if (!end.reached) continue;
+
+            int depth = ctx.top + 1;
+            guesses->stacks = grow_array(guesses->stacks, &capacity, used + depth, sizeof(Symbol));
+            memcpy(guesses->stacks + used, ctx.stack, depth * sizeof(Symbol));
+            guesses->start[candidates[i]] = used;
+            guesses->depth[candidates[i]] = depth;
+            used += depth;
+            break;
+        }
+    }
+    parse_context_free(&ctx);
+}
+
+static void count_depth_task(void *arg, int task, int worker) {
+    (void)worker;
+    ParallelJob *job = arg;
+    const unsigned char *p = (const unsigned char *)job->data + job->length * task / job->chunk_count;
+    const unsigned char *end = (const unsigned char *)job->data + job->length * (task + 1) / job->chunk_count;
+    int64_t delta = 0;
+    for (; p < end; p++) delta += (*p == '(') - (*p == ')');
+    job->depths[task] = delta;
+}
+
+// Function to find the first operator outside all parentheses in a chunk
+// after the first
+static void find_split_task(void *arg, int task, int worker) {
+    (void)worker;
+    ParallelJob *job = arg;
+    int chunk = task + 1;
+    size_t pos = job->length * chunk / job->chunk_count;
+    size_t end = job->length * (chunk + 1) / job->chunk_count;
+    int64_t depth = job->depths[chunk];
+    job->splits[chunk] = UINT64_MAX;
+    for (; pos < end; pos++) {
+        unsigned char c = job->data[pos];
+        if (depth == 0 && job->guesses->start[c] >= 0) {
+            job->splits[chunk] = pos;
+            return;
+        }
+        depth += (c == '(') - (c == ')');
+    }
+}
+
+// Function to parse a segment from its loaded stack up to its end
+static void run_segment(const char *data, size_t length, Segment *segment) {
+    InputStream in;
+    stream_open_buffer(&in, data, length);
+    in.pos = segment->start;
+    segment->end.reached = false;
+    segment->accepted = parse_segment(&segment->ctx, &in, &segment->end);
+    segment->stop_offset = stream_offset(&in);
+}
+
+static void parse_segment_task(void *arg, int task, int worker) {
+    (void)worker;
+    ParallelJob *job = arg;
+    run_segment(job->data, job->length, &job->segments[task]);
+}
+
+// Function to parse one long input on `threads` threads (0 = one per online
+// CPU), reading `data` in place. The result and the offset where parsing
+// stopped are those of parse_stream. Inputs of less than PARALLEL_SEGMENT
+// bytes per thread are parsed sequentially.
+bool parse_parallel(const Grammar *g, const char *data, size_t length, int threads, ParallelResult *result) {
+    ParallelResult local;
+    if (!result) result = &local;
+    if (threads <= 0) threads = default_thread_count();
+    int chunk_count = (size_t)threads < length / PARALLEL_SEGMENT ? threads : (int)(length / PARALLEL_SEGMENT);
+    result->segments = 1;
+    result->reparsed = 0;
+
+    if (chunk_count < 2) {
+        ParseContext ctx;
+        parse_context_init(&ctx, g);
+        InputStream in;
+        stream_open_buffer(&in, data, length);
+        result->accepted = parse_stream(&ctx, &in, NULL);
+        result->stop_offset = stream_offset(&in);
+        parse_context_free(&ctx);
+        return result->accepted;
+    }
+
+    // Depth at each chunk's start by a prefix sum over the chunks, then at
+    // most one split per chunk
+    BoundaryGuesses guesses;
+    probe_boundary_guesses(g, &guesses);
+    ParallelJob job = {data, length, chunk_count, &guesses, malloc(chunk_count * sizeof(int64_t)),
+                       malloc(chunk_count * sizeof(uint64_t)), malloc(chunk_count * sizeof(Segment))};
+    run_parallel(threads, chunk_count, count_depth_task, &job);
+    int64_t depth = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        int64_t delta = job.depths[c];
+        job.depths[c] = depth;
+        depth += delta;
+    }
+    run_parallel(threads < chunk_count - 1 ? threads : chunk_count - 1, chunk_count - 1, find_split_task, &job);
+
+    // Segment k runs from just after its operator to just after the next one
+    const Symbol start[2] = {g->end_marker, NT_SYMBOL(g->start_symbol)};
+    int segment_count = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        if (c > 0 && job.splits[c] == UINT64_MAX) continue;
+        Segment *segment = &job.segments[segment_count++];
+        parse_context_init(&segment->ctx, g);
+        if (c == 0) {
+            segment->start = 0;
+            segment->guess = start;
+            segment->guess_depth = 2;
+        } else {
+            unsigned char op = data[job.splits[c]];
+            segment->start = job.splits[c] + 1;
+            segment->guess = guesses.stacks + guesses.start[op];
+            segment->guess_depth = guesses.depth[op];
+            job.segments[segment_count - 2].end.offset = segment->start;
+        }
+        segment->end.offset = UINT64_MAX;
+        load_stack(&segment->ctx, segment->guess, segment->guess_depth);
+    }
+    run_parallel(threads < segment_count ? threads : segment_count, segment_count, parse_segment_task, &job);
+
+    // Stitch: the first segment that does not reach its end decides
+    result->segments = segment_count;
+    for (int k = 0;; k++) {
+        Segment *segment = &job.segments[k];
+        if (k == segment_count - 1 || !segment->end.reached) {
+            result->accepted = segment->accepted;
+            result->stop_offset = segment->stop_offset;
+            break;
+        }
+        // A literal can run past the next segment's start, so the place
+        // where this one stopped has to match too
+        Segment *next = &job.segments[k + 1];
+        uint64_t next_token = next->start;
+        while (next_token < length && isspace((unsigned char)data[next_token])) next_token++;
+        int ended = segment->ctx.top + 1;
+        if (segment->stop_offset != next_token || ended != next->guess_depth
+            || memcmp(segment->ctx.stack, next->guess, ended * sizeof(Symbol)) != 0) {
+            next->start = segment->stop_offset;
+            load_stack(&next->ctx, segment->ctx.stack, ended);
+            run_segment(data, length, next);
+            result->reparsed++;
+        }
+    }
+
+    for (int k = 0; k < segment_count; k++) parse_context_free(&job.segments[k].ctx);
+    free(job.depths);
+    free(job.splits);
+    free(job.segments);
+    free(guesses.stacks);
+    return result->accepted;
+}
+
+// Hot-reloadable grammars: the current grammar is one atomic pointer, and
+// replaced grammars are freed by epoch-based reclamation. Each reading thread
+// owns a slot holding the global epoch it entered at (0 while outside a read
+// section). Publishing swaps the pointer and then advances the epoch, so a
+// reader that entered at a later epoch can only have seen the new grammar; an
+// old grammar is freed once every slot is idle or past its retirement epoch.
+typedef struct ReaderSlot {
+    _Alignas(64) _Atomic uint64_t epoch;    // Global epoch at entry, 0 when idle
+    atomic_bool claimed;                    // Owned by a running thread
+    struct ReaderSlot *next;
+} ReaderSlot;
+
+typedef struct RetiredGrammar {
+    Grammar *grammar;
+    uint64_t epoch;                         // Global epoch when it was replaced
+    struct RetiredGrammar *next;
+} RetiredGrammar;
+
+struct SharedGrammar {
+    _Atomic(Grammar *) current;
+    _Atomic uint64_t version;               // Grammars published so far
+    pthread_mutex_t lock;                   // Serializes publishing and reclamation
+    RetiredGrammar *retired;                // Replaced grammars not yet freed
+    int retired_count;
+};
+
+static _Atomic uint64_t global_epoch = 1;
+static ReaderSlot *_Atomic reader_slots;    // Never shrinks; slots are reused
+static pthread_once_t reader_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t reader_key;            // Releases a thread's slot when it exits
+static _Thread_local ReaderSlot *thread_reader;
+static _Thread_local int reader_depth;      // Nested read sections of this thread
+
+static void release_reader_slot(void *slot) {
+    atomic_store(&((ReaderSlot *)slot)->claimed, false);
+}
+
+static void create_reader_key(void) {
+    pthread_key_create(&reader_key, release_reader_slot);
+}
+
+// Function to give the calling thread a reader slot: a free one from the
+// list, or a new one pushed onto it
+static ReaderSlot *claim_reader_slot(void) {
+    pthread_once(&reader_key_once, create_reader_key);
+    ReaderSlot *slot;
+    for (slot = atomic_load(&reader_slots); slot; slot = slot->next) {
+        bool expected = false;
+        if (atomic_compare_exchange_strong(&slot->claimed, &expected, true)) break;
+    }
+    if (!slot) {
+        slot = aligned_alloc(_Alignof(ReaderSlot), sizeof(ReaderSlot));
+        atomic_init(&slot->epoch, 0);
+        atomic_init(&slot->claimed, true);
+        slot->next = atomic_load(&reader_slots);
+        while (!atomic_compare_exchange_weak(&reader_slots, &slot->next, slot)) {}
+    }
+    pthread_setspecific(reader_key, slot);
+    return slot;
+}
+
+// Function to free the retired grammars no reader can still be using
+static void reclaim_retired(SharedGrammar *shared) {
+    uint64_t oldest = UINT64_MAX;
+    for (ReaderSlot *slot = atomic_load(&reader_slots); slot; slot = slot->next) {
+        uint64_t epoch = atomic_load(&slot->epoch);
+        if (epoch && epoch < oldest) oldest = epoch;
+    }
+    RetiredGrammar **link = &shared->retired;
+    while (*link) {
+        RetiredGrammar *retired = *link;
+        if (retired->epoch < oldest) {
+            *link = retired->next;
+            free_grammar(retired->grammar);
+            free(retired->grammar);
+            free(retired);
+            shared->retired_count--;
+        } else {
+            link = &retired->next;
+        }
+    }
+}
+
+// Function to share a compiled grammar. Its contents move into the shared
+// grammar and *g is left empty.
+SharedGrammar *shared_grammar_create(Grammar *g) {
+    SharedGrammar *shared = calloc(1, sizeof(SharedGrammar));
+    pthread_mutex_init(&shared->lock, NULL);
+    atomic_init(&shared->current, NULL);
+    atomic_init(&shared->version, 0);
+    shared_grammar_publish(shared, g);
+    return shared;
+}
+
+// Function to free a shared grammar and every grammar it retired. No thread
+// may be reading it.
+void shared_grammar_free(SharedGrammar *shared) {
+    Grammar *current = atomic_load(&shared->current);
+    free_grammar(current);
+    free(current);
+    while (shared->retired) {
+        RetiredGrammar *retired = shared->retired;
+        shared->retired = retired->next;
+        free_grammar(retired->grammar);
+        free(retired->grammar);
+        free(retired);
+    }
+    pthread_mutex_destroy(&shared->lock);
+    free(shared);
+}
+
+// Function to make a compiled grammar the current one. Parses already running
+// finish on the grammar they started with; it is freed after the last of them.
+void shared_grammar_publish(SharedGrammar *shared, Grammar *g) {
+    Grammar *next = malloc(sizeof(Grammar));
+    *next = *g;
+#ifdef LL1_PROFILE
+    profile_move(g, next);
+#endif
+    grammar_init(g);
+
+    pthread_mutex_lock(&shared->lock);
+    Grammar *old = atomic_exchange(&shared->current, next);
+    atomic_fetch_add(&shared->version, 1);
+    if (old) {
+        RetiredGrammar *retired = malloc(sizeof(RetiredGrammar));
+        retired->grammar = old;
+        retired->epoch = atomic_fetch_add(&global_epoch, 1);
+        retired->next = shared->retired;
+        shared->retired = retired;
+        shared->retired_count++;
+    }
+    reclaim_retired(shared);
+    pthread_mutex_unlock(&shared->lock);
+}
+
+// Function to load and compile a grammar file (or map a compiled one) on the
+// calling thread and publish it. On failure the current grammar stays; that
+// includes a file with no rules, as an editor leaves it while rewriting it.
+bool shared_grammar_reload(SharedGrammar *shared, const char *path) {
+    Grammar g;
+    grammar_init(&g);
+    if (is_compiled_grammar_file(path)) {
+        if (!map_grammar(&g, path)) return false;
+    } else if (!load_grammar(&g, path)) {
+        free_grammar(&g);
+        return false;
+    }
+    if (g.rule_count == 0) {
+        fprintf(stderr, "Error: %s: no productions\n", path);
+        free_grammar(&g);
+        return false;
+    }
+    if (!g.mapping && !compile_grammar(&g)) {
+        check_ll1(&g, path);
+        free_grammar(&g);
+        return false;
+    }
+    shared_grammar_publish(shared, &g);
+    return true;
+}
+
+// Function to free what retired grammars can be freed; returns how many remain
+int shared_grammar_reclaim(SharedGrammar *shared) {
+    pthread_mutex_lock(&shared->lock);
+    reclaim_retired(shared);
+    int remaining = shared->retired_count;
+    pthread_mutex_unlock(&shared->lock);
+    return remaining;
+}
+
+uint64_t shared_grammar_version(SharedGrammar *shared) {
+    return atomic_load(&shared->version);
+}
+
+// Function to enter a read section and get the current grammar, which stays
+// valid until the matching shared_grammar_release. The slot's epoch is stored
+// before the pointer is loaded, both sequentially consistent, which is what
+// lets reclamation trust an idle slot.
+const Grammar *shared_grammar_acquire(SharedGrammar *shared) {
+    if (reader_depth++ == 0) {
+        if (!thread_reader) thread_reader = claim_reader_slot();
+        atomic_store(&thread_reader->epoch, atomic_load(&global_epoch));
+    }
+    return atomic_load(&shared->current);
+}
+
+void shared_grammar_release(SharedGrammar *shared) {
+    (void)shared;
+    if (--reader_depth == 0) atomic_store_explicit(&thread_reader->epoch, 0, memory_order_release);
+}
+
+// Function to parse an input string with whichever grammar is current
+bool shared_parse_input(SharedGrammar *shared, ParseContext *ctx, const char *input, TraceLog *trace) {
+    ctx->grammar = shared_grammar_acquire(shared);
+    bool accepted = parse_input(ctx, input, trace);
+    shared_grammar_release(shared);
+    return accepted;
+}
+
+// Result cache: a bounded memo of parse results keyed by the input bytes,
+// which are the parser's token stream, together with the table_id of the
+// grammar and what was asked for (verdict, value or tree). Entries are split
+// over shards by hash, each with its own lock, chained hash index and CLOCK
+// ring: a hit sets an entry's referenced bit, and eviction sweeps the ring,
+// clearing set bits and evicting the first entry it finds clear. New entries
+// start referenced, so each survives one sweep of the hand. Every shard keeps
+// to an equal share of the capacity in bytes.
+enum {
+    CACHE_PARSE,
+    CACHE_EVAL,
+    CACHE_TREE
+};
+
+typedef struct CacheEntry {
+    struct CacheEntry *next;        // Next entry in the same bucket
+    uint64_t hash;
+    uint64_t table_id;
+    size_t length;                  // Input bytes, stored after the tree nodes
+    size_t size;                    // Bytes charged against the shard's capacity
+    int kind;                       // CACHE_PARSE, CACHE_EVAL or CACHE_TREE
+    bool referenced;                // CLOCK bit
+    bool accepted;
+    EvalStatus status;
+    int64_t value;
+    int node_count;
+    ParseNode nodes[];              // Tree nodes, then the input
+} CacheEntry;
+
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    CacheEntry **buckets;
+    int bucket_count;               // Power of two
+    CacheEntry **ring;              // CLOCK slots; an entry keeps its slot, which is NULL once evicted
+    int slot_count;                 // Slots in use, empty ones included
+    int ring_capacity;
+    int *free_slots;                // Empty slots, refilled before the ring grows
+    int free_count;
+    int free_capacity;
+    int entry_count;
+    int hand;
+    size_t bytes;
+    size_t capacity;
+    uint64_t lookups, hits, inserts, evictions;
+} CacheShard;
+
+struct ResultCache {
+    CacheShard *shards;
+    int shard_count;
+};
+
+// Function to hash a byte string 8 bytes at a time with multiply-xorshift
+// mixing, seeded with the table and the kind of result
+static uint64_t hash_input(const char *data, size_t length, uint64_t seed) {
+    uint64_t h = seed * 0x9E3779B97F4A7C15ull ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 31;
+    }
+    uint64_t word = 0;
+    memcpy(&word, data + i, length - i);
+    h = (h ^ word) * 0x94D049BB133111EBull;
+    return h ^ (h >> 29);
+}
+
+static const char *entry_input(const CacheEntry *entry) {
+    return (const char *)(entry->nodes + entry->node_count);
+}
+
+// Function to create a cache of about `capacity` bytes in `shard_count`
+// shards (0 = four per online CPU)
+ResultCache *result_cache_create(size_t capacity, int shard_count) {
+    if (shard_count <= 0) shard_count = 4 * default_thread_count();
+    ResultCache *cache = malloc(sizeof(ResultCache));
+    cache->shard_count = shard_count;
+    cache->shards = aligned_alloc(_Alignof(CacheShard), shard_count * sizeof(CacheShard));
+    for (int s = 0; s < shard_count; s++) {
+        CacheShard *shard = &cache->shards[s];
+        memset(shard, 0, sizeof(*shard));
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->bucket_count = 16;
+        shard->buckets = calloc(shard->bucket_count, sizeof(CacheEntry *));
+        shard->capacity = capacity / shard_count;
+    }
+    return cache;
+}
+
+// Function to drop every entry; the counters are kept
+void result_cache_clear(ResultCache *cache) {
+    for (int s = 0; s < cache->shard_count; s++) {
+        CacheShard *shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        for (int i = 0; i < shard->slot_count; i++) free(shard->ring[i]);
+        memset(shard->buckets, 0, shard->bucket_count * sizeof(CacheEntry *));
+        shard->slot_count = 0;
+        shard->free_count = 0;
+        shard->entry_count = 0;
+        shard->hand = 0;
+        shard->bytes = 0;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+void result_cache_free(ResultCache *cache) {
+    result_cache_clear(cache);
+    for (int s = 0; s < cache->shard_count; s++) {
+        pthread_mutex_destroy(&cache->shards[s].lock);
+        free(cache->shards[s].buckets);
+        free(cache->shards[s].ring);
+        free(cache->shards[s].free_slots);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+// Function to sum the counters of all shards
+void result_cache_stats(ResultCache *cache, CacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int s = 0; s < cache->shard_count; s++) {
+        CacheShard *shard = &cache->shards[s];
+        pthread_mutex_lock(&shard->lock);
+        stats->lookups += shard->lookups;
+        stats->hits += shard->hits;
+        stats->inserts += shard->inserts;
+        stats->evictions += shard->evictions;
+        stats->entries += shard->entry_count;
+        stats->bytes += shard->bytes;
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+// Function to find an entry in a locked shard. The key is the raw input
+// bytes, so inputs that differ only in whitespace have separate entries even
+// though they parse alike; normalizing would cost a pass over every input.
+static CacheEntry *find_entry(CacheShard *shard, uint64_t hash, uint64_t table_id, int kind,
+                              const char *input, size_t length) {
+    for (CacheEntry *entry = shard->buckets[hash & (shard->bucket_count - 1)]; entry; entry = entry->next) {
+        if (entry->hash == hash && entry->table_id == table_id && entry->kind == kind && entry->length == length
+            && memcmp(entry_input(entry), input, length) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Function to evict the entry under the CLOCK hand, after giving every
+// referenced entry on the way a second chance. The victim's slot is emptied
+// in place, so no other entry moves relative to the hand, and the hand stays
+// on it for the entry that refills it.
+static void evict_entry(CacheShard *shard) {
+    while (!shard->ring[shard->hand] || shard->ring[shard->hand]->referenced) {
+        if (shard->ring[shard->hand]) shard->ring[shard->hand]->referenced = false;
+        shard->hand = (shard->hand + 1) % shard->slot_count;
+    }
+    CacheEntry *victim = shard->ring[shard->hand];
+    CacheEntry **link = &shard->buckets[victim->hash & (shard->bucket_count - 1)];
+    while (*link != victim) link = &(*link)->next;
+    *link = victim->next;
+
+    shard->ring[shard->hand] = NULL;
+    shard->free_slots = grow_array(shard->free_slots, &shard->free_capacity, shard->free_count + 1, sizeof(int));
+    shard->free_slots[shard->free_count++] = shard->hand;
+    shard->entry_count--;
+    shard->bytes -= victim->size;
+    shard->evictions++;
+    free(victim);
+}
+
+// Function to add an entry to a locked shard, evicting until it fits. An
+// entry larger than the whole shard is not kept.
+static void insert_entry(CacheShard *shard, CacheEntry *entry) {
+    if (entry->size > shard->capacity) {
+        free(entry);
+        return;
+    }
+    while (shard->bytes + entry->size > shard->capacity) evict_entry(shard);
+
+    // Keep the hash index at most one entry per bucket on average
+    if (shard->entry_count + 1 > shard->bucket_count) {
+        int bucket_count = shard->bucket_count * 2;
+        CacheEntry **buckets = calloc(bucket_count, sizeof(CacheEntry *));
+        for (int i = 0; i < shard->slot_count; i++) {
+            CacheEntry *moved = shard->ring[i];
+            if (!moved) continue;
+            CacheEntry **bucket = &buckets[moved->hash & (bucket_count - 1)];
+            moved->next = *bucket;
+            *bucket = moved;
+        }
+        free(shard->buckets);
+        shard->buckets = buckets;
+        shard->bucket_count = bucket_count;
+    }
+
+    CacheEntry **bucket = &shard->buckets[entry->hash & (shard->bucket_count - 1)];
+    entry->next = *bucket;
+    *bucket = entry;
+    entry->referenced = true;
+    if (shard->free_count) {
+        shard->ring[shard->free_slots[--shard->free_count]] = entry;
+    } else {
+        shard->ring = grow_array(shard->ring, &shard->ring_capacity, shard->slot_count + 1, sizeof(CacheEntry *));
+        shard->ring[shard->slot_count++] = entry;
+    }
+    shard->entry_count++;
+    shard->bytes += entry->size;
+    shard->inserts++;
+}
+
+// Function to look up one kind of result for an input, parsing it on a miss
+// and keeping the result. The result is copied into *result, without its
+// tree, which goes into `tree` for CACHE_TREE.
+static void cached_parse(ResultCache *cache, ParseContext *ctx, const char *input, int kind,
+                         CacheEntry *result, ParseTree *tree) {
+    size_t length = strlen(input);
+    uint64_t table_id = ctx->grammar->table_id;
+    uint64_t hash = hash_input(input, length, table_id * 4 + kind);
+    CacheShard *shard = &cache->shards[(hash >> 40) % cache->shard_count];
+
+    pthread_mutex_lock(&shard->lock);
+    shard->lookups++;
+    CacheEntry *entry = find_entry(shard, hash, table_id, kind, input, length);
+    if (entry) {
+        entry->referenced = true;
+        shard->hits++;
+        *result = *entry;
+        if (kind == CACHE_TREE) {
+            tree->count = 0;
+            tree_alloc(tree, entry->node_count);
+            memcpy(tree->nodes, entry->nodes, entry->node_count * sizeof(ParseNode));
+        }
+        pthread_mutex_unlock(&shard->lock);
+        return;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    // Miss: parse outside the lock, then keep the result unless another
+    // thread has kept it meanwhile
+    result->accepted = false;
+    result->status = EVAL_OK;
+    result->value = 0;
+    result->node_count = 0;
+    if (kind == CACHE_EVAL) {
+        result->status = evaluate_input(ctx, input, NULL, &result->value);
+        result->accepted = result->status == EVAL_OK;
+    } else if (kind == CACHE_TREE) {
+        result->accepted = parse_input_tree(ctx, input, NULL, tree);
+        if (result->accepted) result->node_count = tree->count;
+    } else {
+        result->accepted = parse_input(ctx, input, NULL);
+    }
+
+    size_t size = sizeof(CacheEntry) + result->node_count * sizeof(ParseNode) + length;
+    entry = malloc(size);
+    *entry = *result;
+    entry->hash = hash;
+    entry->table_id = table_id;
+    entry->length = length;
+    entry->size = size;
+    entry->kind = kind;
+    if (result->node_count) memcpy(entry->nodes, tree->nodes, result->node_count * sizeof(ParseNode));
+    memcpy((char *)entry_input(entry), input, length);
+
+    pthread_mutex_lock(&shard->lock);
+    if (find_entry(shard, hash, table_id, kind, input, length)) {
+        free(entry);
+    } else {
+        insert_entry(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Function to parse an input string through the cache
+bool cached_parse_input(ResultCache *cache, ParseContext *ctx, const char *input) {
+    CacheEntry result;
+    cached_parse(cache, ctx, input, CACHE_PARSE, &result, NULL);
+    return result.accepted;
+}
+
+// Function to evaluate an input string through the cache
+EvalStatus cached_evaluate_input(ResultCache *cache, ParseContext *ctx, const char *input, int64_t *value) {
+    CacheEntry result;
+    cached_parse(cache, ctx, input, CACHE_EVAL, &result, NULL);
+    if (result.status == EVAL_OK) *value = result.value;
+    return result.status;
+}
+
+// Function to parse an input string and get its parse tree through the
+// cache. Only the trees of accepted inputs are kept, so after a rejection
+// the tree is partial on a miss and empty on a hit.
+bool cached_parse_input_tree(ResultCache *cache, ParseContext *ctx, const char *input, ParseTree *tree) {
+    CacheEntry result;
+    cached_parse(cache, ctx, input, CACHE_TREE, &result, tree);
+    return result.accepted;
+}
+
+#ifndef LL1_NO_MAIN
+
+// Reference implementations: a global worklist fixpoint over all rules, and
+// re-sweeping every rule until nothing changes. Only used by the benchmark to
+// check results and measure the speedup.
+
+// FIFO worklist of rule indices; a rule is queued at most once at a time
+typedef struct {
+    int *items;
+    bool *queued;
+    int size;
+    int head;
+    int count;
+} RuleQueue;
+
+static void queue_init_all(RuleQueue *queue, int rule_count) {
+    queue->items = malloc((rule_count ? rule_count : 1) * sizeof(int));
+    queue->queued = malloc((rule_count ? rule_count : 1) * sizeof(bool));
+    for (int i = 0; i < rule_count; i++) {
+        queue->items[i] = i;
+        queue->queued[i] = true;
+    }
+    queue->size = rule_count;
+    queue->head = 0;
+    queue->count = rule_count;
+}
+
+static void queue_free(RuleQueue *queue) {
+    free(queue->items);
+    free(queue->queued);
+}
+
+static void queue_push(RuleQueue *queue, int rule) {
+    if (queue->queued[rule]) return;
+    queue->queued[rule] = true;
+    queue->items[(queue->head + queue->count++) % queue->size] = rule;
+}
+
+static bool queue_pop(RuleQueue *queue, int *rule) {
+    if (queue->count == 0) return false;
+    *rule = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->size;
+    queue->count--;
+    queue->queued[*rule] = false;
+    return true;
+}
+
+// Function to fold one rule into FIRST(lhs); returns true if FIRST(lhs) grew.
+// When a queue is given, rules that depend on FIRST(lhs) are re-queued.
+// `scratch` must hold g->set_words words.
+static bool apply_first_rule(Grammar *g, int r, const RuleIndex *index, RuleQueue *queue, uint64_t *scratch) {
+    const ProductionRule *rule = &g->rules[r];
+    FirstFollow *lhs_sets = &g->firstFollow[rule->lhs];
+
+    memset(scratch, 0, g->set_words * sizeof(uint64_t));
+    bool nullable = first_of_sequence(g, rule_rhs(g, rule), rule->rhs_len, scratch);
+    bool changed = set_union(lhs_sets->first, scratch, g->set_words);
+    if (nullable && !lhs_sets->first_epsilon) {
+        lhs_sets->first_epsilon = true;
+        changed = true;
+    }
+
+    if (changed && queue) {
+        for (int k = index->uses_start[rule->lhs]; k < index->uses_start[rule->lhs + 1]; k++) {
+            queue_push(queue, index->uses_list[k]);
+        }
+    }
+    return changed;
+}
+
+// Function to fold one rule A → α into the FOLLOW sets of the non-terminals in α.
+// α is walked right to left keeping the "trailer": the terminals that can follow
+// the current position. Returns true if any FOLLOW set grew; when a queue is
+// given, the rules of every grown non-terminal are re-queued.
+// `trailer` must hold g->set_words words.
+static bool apply_follow_rule(Grammar *g, int r, const RuleIndex *index, RuleQueue *queue, uint64_t *trailer) {
+    const ProductionRule *rule = &g->rules[r];
+    const Symbol *rhs = rule_rhs(g, rule);
+    int words = g->set_words;
+    bool any_changed = false;
+
+    memcpy(trailer, g->firstFollow[rule->lhs].follow, words * sizeof(uint64_t));
+
+    // The reversed span is already in right-to-left order
+    for (int j = 0; j < rule->rhs_len; j++) {
+        if (is_terminal(rhs[j])) {
+            memset(trailer, 0, words * sizeof(uint64_t));
+            set_add(trailer, rhs[j]);
+            continue;
+        }
+
+        int nt_index = NT_INDEX(rhs[j]);
+        if (set_union(g->firstFollow[nt_index].follow, trailer, words)) {
+            any_changed = true;
+            if (queue) {
+                for (int k = index->lhs_start[nt_index]; k < index->lhs_start[nt_index + 1]; k++) {
+                    queue_push(queue, index->lhs_list[k]);
+                }
+            }
+        }
+
+        // Update trailer: FIRST(B) if B is not nullable, else FIRST(B) ∪ trailer
+        if (g->firstFollow[nt_index].first_epsilon) {
+            set_union(trailer, g->firstFollow[nt_index].first, words);
+        } else {
+            memcpy(trailer, g->firstFollow[nt_index].first, words * sizeof(uint64_t));
+        }
+    }
+    return any_changed;
+}
+
+// Global worklist fixpoint: every rule is evaluated once; afterwards a rule is
+// only revisited when the FIRST set of a non-terminal on its right-hand side
+// has grown.
+static void compute_first_worklist(Grammar *g) {
+    RuleIndex index;
+    RuleQueue queue;
+    uint64_t *scratch = malloc(g->set_words * sizeof(uint64_t) + 1);
+    int r;
+
+    index_rules(g, &index);
+    clear_first(g);
+    queue_init_all(&queue, g->rule_count);
+    while (queue_pop(&queue, &r)) {
+        apply_first_rule(g, r, &index, &queue, scratch);
+    }
+    queue_free(&queue);
+    free_rule_index(&index);
+    free(scratch);
+}
+
+// Same for FOLLOW: a rule is revisited only when the FOLLOW set of its LHS has grown.
+static void compute_follow_worklist(Grammar *g) {
+    RuleIndex index;
+    RuleQueue queue;
+    uint64_t *trailer = malloc(g->set_words * sizeof(uint64_t) + 1);
+    int r;
+
+    index_rules(g, &index);
+    clear_follow(g);
+    queue_init_all(&queue, g->rule_count);
+    while (queue_pop(&queue, &r)) {
+        apply_follow_rule(g, r, &index, &queue, trailer);
+    }
+    queue_free(&queue);
+    free_rule_index(&index);
+    free(trailer);
+}
+
+// Full sweeps: every rule, every round, until a round changes nothing
+static void compute_first_sweep(Grammar *g) {
+    uint64_t *scratch = malloc(g->set_words * sizeof(uint64_t) + 1);
+    bool changed;
+
+    clear_first(g);
+    do {
+        changed = false;
+        for (int i = 0; i < g->rule_count; i++) {
+            changed |= apply_first_rule(g, i, NULL, NULL, scratch);
+        }
+    } while (changed);
+    free(scratch);
+}
+
+static void compute_follow_sweep(Grammar *g) {
+    uint64_t *trailer = malloc(g->set_words * sizeof(uint64_t) + 1);
+    bool changed;
+
+    clear_follow(g);
+    do {
+        changed = false;
+        for (int i = 0; i < g->rule_count; i++) {
+            changed |= apply_follow_rule(g, i, NULL, NULL, trailer);
+        }
+    } while (changed);
+    free(trailer);
+}
+
+// Small deterministic PRNG (xorshift32) for the benchmark generators
+static uint32_t bench_rng_state = 2463534242u;
+
+static uint32_t bench_rand() {
+    bench_rng_state ^= bench_rng_state << 13;
+    bench_rng_state ^= bench_rng_state >> 17;
+    bench_rng_state ^= bench_rng_state << 5;
+    return bench_rng_state;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Function to build a random grammar. Non-terminal N[i] mostly refers to the
+// `span` non-terminals after it, so FIRST information has to flow backwards
+// through the rule order: the worst case for a full sweep. `cycle_percent` of
+// the references point back to one of the `span` before it instead, which
+// ties non-terminals into cycles.
+static void generate_synthetic_grammar(Grammar *g, int nt_count, int t_count, int alternatives, int epsilon_percent,
+                                       int span, int cycle_percent) {
+    char name[32];
+    Symbol rhs[8];
+
+    bench_rng_state = 2463534242u;   // Same parameters, same grammar
+    grammar_init(g);
+    for (int i = 0; i < nt_count; i++) {
+        snprintf(name, sizeof(name), "N%d", i);
+        add_non_terminal(g, name);
+    }
+    for (int i = 0; i < t_count; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        add_terminal(g, name);
+    }
+
+    for (int i = 0; i < nt_count; i++) {
+        for (int a = 0; a < alternatives; a++) {
+            int len = 0;
+
+            if ((int)(bench_rand() % 100) >= epsilon_percent) {
+                int want = 1 + bench_rand() % 8;
+                while (len < want) {
+                    if (bench_rand() % 4 == 0 || i == nt_count - 1) {
+                        rhs[len++] = bench_rand() % t_count;
+                    } else if (cycle_percent > 0 && i > 0 && (int)(bench_rand() % 100) < cycle_percent) {
+                        rhs[len++] = NT_SYMBOL(i - 1 - bench_rand() % (i < span ? i : span));
+                    } else {
+                        int after = nt_count - i - 1;
+                        rhs[len++] = NT_SYMBOL(i + 1 + bench_rand() % (after < span ? after : span));
+                    }
+                }
+            }
+            add_rule_symbols(g, i, rhs, len);
+        }
+    }
+    finish_grammar(g);
+}
+
+// Function to build a random grammar shaped like a real language, whose
+// parsing table is sparse: most alternatives start with a terminal of their
+// own (a keyword or punctuation), the rest with a later non-terminal, and
+// `epsilon_percent` of the non-terminals get an extra ε-alternative
+static void generate_sparse_grammar(Grammar *g, int nt_count, int t_count, int alternatives, int epsilon_percent) {
+    char name[32];
+    Symbol rhs[8];
+
+    bench_rng_state = 2463534242u;
+    grammar_init(g);
+    for (int i = 0; i < nt_count; i++) {
+        snprintf(name, sizeof(name), "N%d", i);
+        add_non_terminal(g, name);
+    }
+    for (int i = 0; i < t_count; i++) {
+        snprintf(name, sizeof(name), "t%d", i);
+        add_terminal(g, name);
+    }
+
+    for (int i = 0; i < nt_count; i++) {
+        for (int a = 0; a < alternatives; a++) {
+            int len = 0;
+            int after = nt_count - i - 1;
+            if (after > 0 && bench_rand() % 8 == 0) {
+                rhs[len++] = NT_SYMBOL(i + 1 + bench_rand() % (after < 4 ? after : 4));
+            } else {
+                rhs[len++] = bench_rand() % t_count;
+            }
+            int want = 1 + bench_rand() % 6;
+            while (len < want) {
+                if (after > 0 && bench_rand() % 2 == 0) {
+                    rhs[len++] = NT_SYMBOL(i + 1 + bench_rand() % after);
+                } else {
+                    rhs[len++] = bench_rand() % t_count;
+                }
+            }
+            add_rule_symbols(g, i, rhs, len);
+        }
+        if ((int)(bench_rand() % 100) < epsilon_percent) add_rule_symbols(g, i, rhs, 0);
+    }
+    finish_grammar(g);
+}
+
+// Function to map an input file read-only for sequential reading. Returns
+// NULL on failure; an empty file maps to "".
+static const char *map_input_file(const char *path, size_t *length) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open input file '%s'\n", path);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    *length = st.st_size;
+    const char *data = "";
+    if (*length > 0) {
+        data = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "Error: Cannot map input file '%s'\n", path);
+            close(fd);
+            return NULL;
+        }
+        madvise((void *)data, *length, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return data;
+}
+
+// Function to validate every line of a file with validate_lines over a
+// read-only memory mapping. Rejected line numbers go to stdout, or, with a
+// bitmap path, one bit per line (1 = accepted, LSB first) is written there.
+static int run_batch(const Grammar *g, const char *path, int threads, const char *bitmap_path) {
+    size_t length;
+    const char *data = map_input_file(path, &length);
+    if (!data) return 1;
+
+    if (threads <= 0) threads = default_thread_count();
+    BatchResult result;
+    double start = now_seconds();
+    validate_lines(g, data, length, threads, &result);
+    double elapsed = now_seconds() - start;
+
+    if (bitmap_path) {
+        size_t bytes = (result.line_count + 7) / 8;
+        uint8_t *bitmap = malloc(bytes + 1);
+        memset(bitmap, 0xFF, bytes);
+        if (result.line_count % 8) bitmap[bytes - 1] = (1u << (result.line_count % 8)) - 1;
+        for (uint64_t i = 0; i < result.failed_count; i++) {
+            uint64_t line = result.failed_lines[i] - 1;
+            bitmap[line / 8] &= ~(1u << (line % 8));
+        }
+        FILE *out = fopen(bitmap_path, "wb");
+        if (!out || fwrite(bitmap, 1, bytes, out) != bytes) {
+            fprintf(stderr, "Error: Cannot write bitmap file '%s'\n", bitmap_path);
+        }
+        if (out) fclose(out);
+        free(bitmap);
+    } else {
+        for (uint64_t i = 0; i < result.failed_count; i++) {
+            printf("%llu\n", (unsigned long long)result.failed_lines[i]);
+        }
+    }
+
+    fprintf(stderr, "%llu lines, %llu rejected, %d threads, %.3f s (%.1f MB/s, %.0f lines/s)\n",
+            (unsigned long long)result.line_count, (unsigned long long)result.failed_count,
+            threads, elapsed, length / 1e6 / elapsed, result.line_count / elapsed);
+
+    int status = result.failed_count ? 2 : 0;
+    batch_result_free(&result);
+    if (length > 0) munmap((void *)data, length);
+    return status;
+}
+
+// Function to parse a whole file as one input with parse_parallel over a
+// read-only memory mapping
+static int run_parallel_parse(const Grammar *g, const char *path, int threads) {
+    size_t length;
+    const char *data = map_input_file(path, &length);
+    if (!data) return 1;
+
+    if (threads <= 0) threads = default_thread_count();
+    ParallelResult result;
+    double start = now_seconds();
+    parse_parallel(g, data, length, threads, &result);
+    double elapsed = now_seconds() - start;
+
+    if (result.accepted) {
+        printf("Input is ACCEPTED by the grammar\n");
+    } else {
+        printf("Input is REJECTED by the grammar (at offset %llu)\n", (unsigned long long)result.stop_offset);
+    }
+    fprintf(stderr, "%zu bytes, %d segments, %d reparsed, %d threads, %.3f s (%.1f MB/s)\n",
+            length, result.segments, result.reparsed, threads, elapsed, length / 1e6 / elapsed);
+
+    if (length > 0) munmap((void *)data, length);
+    return result.accepted ? 0 : 2;
+}
+
+// Benchmark settings from the command line; 0 (or -1 for epsilon_percent)
+// means "sweep the default values"
+typedef struct {
+    int length;                 // Tokens per generated expression
+    int depth;                  // Maximum parenthesis nesting
+    int count;                  // Expressions per case
+    int non_terminals;
+    int terminals;
+    int alternatives;
+    int epsilon_percent;
+    int span;                   // Non-terminals a synthetic rule refers to on either side
+    int cycle_percent;          // Share of references that point back (0 by default)
+    int repeat;                 // Timed runs per case; the fastest is reported
+} BenchOptions;
+
+// Function to run one FIRST+FOLLOW implementation
+typedef enum {
+    SETS_SWEEP,
+    SETS_WORKLIST,
+    SETS_COMPONENTS
+} SetMethod;
+
+static void compute_sets_with(Grammar *g, SetMethod method, int threads) {
+    switch (method) {
+    case SETS_SWEEP:
+        compute_first_sweep(g);
+        compute_follow_sweep(g);
+        break;
+    case SETS_WORKLIST:
+        compute_first_worklist(g);
+        compute_follow_worklist(g);
+        break;
+    case SETS_COMPONENTS:
+        compute_first_threads(g, threads);
+        compute_follow_threads(g, threads);
+        break;
+    }
+}
+
+// Function to print the component structure of the FIRST or FOLLOW graph
+static void print_component_stats(Grammar *g, bool follow) {
+    RuleIndex index;
+    DependencyGraph graph;
+    ComponentSchedule schedule;
+    bool *nullable = malloc(g->non_terminals.count + 1);
+    int largest = 0, widest = 0;
+
+    compute_first_threads(g, 1);
+    for (int n = 0; n < g->non_terminals.count; n++) nullable[n] = g->firstFollow[n].first_epsilon;
+    index_rules(g, &index);
+    build_dependencies(g, nullable, follow, &graph);
+    schedule_components(&graph, g->non_terminals.count, g->set_words, &schedule);
+    for (int c = 0; c < schedule.count; c++) {
+        int size = schedule.member_start[c + 1] - schedule.member_start[c];
+        if (size > largest) largest = size;
+    }
+    for (int l = 0; l < schedule.level_count; l++) {
+        int width = schedule.level_start[l + 1] - schedule.level_start[l];
+        if (width > widest) widest = width;
+    }
+    printf("%s graph: %d components (largest %d), %d levels (widest %d)\n",
+           follow ? "FOLLOW" : "FIRST", schedule.count, largest, schedule.level_count, widest);
+
+    free_schedule(&schedule);
+    free_dependencies(&graph);
+    free_rule_index(&index);
+    free(nullable);
+}
+
+// Function to time the component-scheduled FIRST/FOLLOW computation, on one
+// thread and on `threads`, against the global worklist fixpoint and
+// full-sweep iteration. The worklist result is the reference; the sweep
+// needs a round per dependency level, so it is skipped on large grammars.
+static void run_benchmark(const BenchOptions *options, int threads) {
+    int nt_count = options->non_terminals ? options->non_terminals : 2000;
+    int t_count = options->terminals ? options->terminals : nt_count / 2;
+    Grammar g;
+
+    if (threads <= 0) threads = default_thread_count();
+    generate_synthetic_grammar(&g, nt_count, t_count, options->alternatives ? options->alternatives : 4,
+                               options->epsilon_percent >= 0 ? options->epsilon_percent : 20,
+                               options->span ? options->span : 4, options->cycle_percent);
+    printf("Synthetic grammar: %d non-terminals, %d terminals, %d rules\n",
+           g.non_terminals.count, g.terminals.count, g.rule_count);
+    print_component_stats(&g, false);
+    print_component_stats(&g, true);
+
+    size_t set_bytes = (size_t)g.non_terminals.count * 2 * g.set_words * sizeof(uint64_t);
+    uint64_t *reference = malloc(set_bytes + 1);
+    bool *reference_epsilon = malloc(g.non_terminals.count + 1);
+    static const struct {
+        const char *label;
+        SetMethod method;
+        bool threaded;
+    } cases[] = {
+        {"Worklist", SETS_WORKLIST, false},
+        {"Full sweep", SETS_SWEEP, false},
+        {"Components, 1 thread", SETS_COMPONENTS, false},
+        {"Components", SETS_COMPONENTS, true},
+    };
+    double reference_time = 0;
+
+    for (int m = 0; m < 4; m++) {
+        char label[64];
+        if (cases[m].threaded) {
+            snprintf(label, sizeof(label), "%s, %d thread%s", cases[m].label, threads, threads == 1 ? "" : "s");
+        } else {
+            snprintf(label, sizeof(label), "%s", cases[m].label);
+        }
+        if (cases[m].method == SETS_SWEEP && nt_count > 5000) {
+            printf("%-24s    skipped (more than 5000 non-terminals)\n", label);
+            continue;
+        }
+
+        double start = now_seconds();
+        for (int r = 0; r < options->repeat; r++) {
+            compute_sets_with(&g, cases[m].method, cases[m].threaded ? threads : 1);
+        }
+        double elapsed = (now_seconds() - start) / options->repeat;
+
+        if (m == 0) {
+            reference_time = elapsed;
+            memcpy(reference, g.set_storage, set_bytes);
+            for (int i = 0; i < g.non_terminals.count; i++) reference_epsilon[i] = g.firstFollow[i].first_epsilon;
+        }
+        bool same = memcmp(reference, g.set_storage, set_bytes) == 0;
+        for (int i = 0; i < g.non_terminals.count; i++) {
+            same &= reference_epsilon[i] == g.firstFollow[i].first_epsilon;
+        }
+        printf("%-24s %12.1f us  %6.2fx  %s\n", label, elapsed * 1e6, reference_time / elapsed,
+               same ? "identical" : "DIFFER");
+    }
+
+    free(reference);
+    free(reference_epsilon);
+    free_grammar(&g);
+}
+
+// Function to write a random expression for the built-in grammar with
+// `length` tokens (one or two more when parentheses must be closed) and at
+// most `depth` nesting levels. Operands are 'i', or single-digit literals when
+// `numbers` is set. An invalid expression gets one extra operator right after
+// another operator, so it is rejected at a random point.
+// Returns the nesting depth actually reached.
+static int generate_expression(char *buf, int length, int depth, bool valid, bool numbers) {
+    int n = 0, level = 0, deepest = 0;
+    bool expect_operand = true;
+
+    while (true) {
+        if (expect_operand) {
+            if (level < depth && n + level + 3 < length && bench_rand() % 2 == 0) {
+                buf[n++] = '(';
+                if (++level > deepest) deepest = level;
+            } else {
+                buf[n++] = numbers ? '1' + bench_rand() % 9 : 'i';
+                expect_operand = false;
+            }
+        } else if (level > 0 && (n + level >= length || bench_rand() % 3 == 0)) {
+            buf[n++] = ')';
+            level--;
+        } else if (n < length) {
+            buf[n++] = bench_rand() % 2 ? '+' : '*';
+            expect_operand = true;
+        } else {
+            break;
+        }
+    }
+
+    if (!valid) {
+        int operators = 0;
+        for (int i = 0; i < n; i++) operators += buf[i] == '+' || buf[i] == '*';
+        int pick = operators ? (int)(bench_rand() % operators) : -1;
+        int at = n;
+        for (int i = 0; i < n && pick >= 0; i++) {
+            if ((buf[i] == '+' || buf[i] == '*') && pick-- == 0) at = i + 1;
+        }
+        memmove(buf + at + 1, buf + at, n - at);
+        buf[at] = bench_rand() % 2 ? '+' : '*';
+        n++;
+    }
+    buf[n] = '\0';
+    return deepest;
+}
+
+// Function to time parse_input (tracing off), or evaluate_input on literals,
+// on `count` generated expressions and print one JSON result line
+static void bench_parse_case(const Grammar *g, int length, int depth, int count, int repeat, bool valid, bool evaluate) {
+    // All inputs live in one buffer; each has room for its closing parentheses
+    // and the extra operator of an invalid input
+    size_t stride = (size_t)length + depth + 4;
+    char *inputs = malloc(stride * count);
+    uint64_t tokens = 0;
+    int deepest = 0;
+    for (int i = 0; i < count; i++) {
+        int reached = generate_expression(inputs + stride * i, length, depth, valid, evaluate);
+        if (reached > deepest) deepest = reached;
+        tokens += strlen(inputs + stride * i);
+    }
+
+    ParseContext ctx;
+    parse_context_init(&ctx, g);
+    double best = 0;
+    int accepted = 0;
+    int64_t value;
+    for (int r = 0; r < repeat; r++) {
+        accepted = 0;
+        double start = now_seconds();
+        if (evaluate) {
+            for (int i = 0; i < count; i++) accepted += evaluate_input(&ctx, inputs + stride * i, NULL, &value) == EVAL_OK;
+        } else {
+            for (int i = 0; i < count; i++) accepted += parse_input(&ctx, inputs + stride * i, NULL);
+        }
+        double elapsed = now_seconds() - start;
+        if (r == 0 || elapsed < best) best = elapsed;
+    }
+    parse_context_free(&ctx);
+    free(inputs);
+
+    printf("{\"bench\": \"%s\", \"length\": %d, \"depth\": %d, \"max_depth\": %d, \"valid\": %s, "
+           "\"inputs\": %d, \"tokens\": %llu, \"accepted\": %d, \"seconds\": %.6f, "
+           "\"tokens_per_sec\": %.0f, \"ns_per_token\": %.3f}\n",
+           evaluate ? "eval" : "parse", length, depth, deepest, valid ? "true" : "false", count, (unsigned long long)tokens,
+           accepted, best, tokens / best, best * 1e9 / tokens);
+    fflush(stdout);
+}
+
+// Function to time FIRST, FOLLOW and table construction separately on one
+// synthetic grammar and print one JSON result line
+static void bench_grammar_case(int nt_count, int t_count, int alternatives, int epsilon_percent, int span,
+                               int cycle_percent, int threads, int repeat) {
+    Grammar g;
+    generate_synthetic_grammar(&g, nt_count, t_count, alternatives, epsilon_percent, span, cycle_percent);
+
+    double first_time = 0, follow_time = 0, table_time = 0;
+    for (int r = 0; r < repeat; r++) {
+        double start = now_seconds();
+        compute_first_threads(&g, threads);
+        double after_first = now_seconds();
+        compute_follow_threads(&g, threads);
+        double after_follow = now_seconds();
+        create_parsing_table(&g);
+        double after_table = now_seconds();
+        if (r == 0 || after_first - start < first_time) first_time = after_first - start;
+        if (r == 0 || after_follow - after_first < follow_time) follow_time = after_follow - after_first;
+        if (r == 0 || after_table - after_follow < table_time) table_time = after_table - after_follow;
+    }
+
+    printf("{\"bench\": \"grammar\", \"non_terminals\": %d, \"terminals\": %d, \"alternatives\": %d, "
+           "\"epsilon_percent\": %d, \"span\": %d, \"cycle_percent\": %d, \"threads\": %d, \"rules\": %d, "
+           "\"first_us\": %.1f, \"follow_us\": %.1f, \"table_us\": %.1f}\n",
+           g.non_terminals.count, g.terminals.count, alternatives, epsilon_percent, span, cycle_percent,
+           threads, g.rule_count, first_time * 1e6, follow_time * 1e6, table_time * 1e6);
+    fflush(stdout);
+    free_grammar(&g);
+}
+
+// Function to run the parse (or evaluation) benchmark: valid and invalid
+// expressions over a grid of lengths and depths, unless given on the command
+// line. Each case parses about a million tokens.
+static void run_parse_benchmark(const BenchOptions *options, bool evaluate) {
+    static const int default_lengths[] = {16, 256, 4096};
+    static const int default_depths[] = {1, 8, 64};
+    const int *lengths = options->length ? &options->length : default_lengths;
+    const int *depths = options->depth ? &options->depth : default_depths;
+    int length_count = options->length ? 1 : 3;
+    int depth_count = options->depth ? 1 : 3;
+
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    for (int l = 0; l < length_count; l++) {
+        for (int d = 0; d < depth_count; d++) {
+            int count = options->count ? options->count : (1 << 20) / lengths[l] + 1;
+            bench_parse_case(&g, lengths[l], depths[d], count, options->repeat, true, evaluate);
+            bench_parse_case(&g, lengths[l], depths[d], count, options->repeat, false, evaluate);
+        }
+    }
+    free_grammar(&g);
+}
+
+// Function to build one long valid expression of about `size` bytes for the
+// lexer benchmark: operands are numbers of 1-8 digits (or, with
+// `identifiers`, names of 1-8 letters), with 0-3 spaces around operators
+static char *generate_spaced_expression(size_t size, bool identifiers) {
+    char *text = malloc(size + 64);
+    size_t n = 0;
+    int level = 0;
+
+    while (true) {
+        while (n + level + 32 < size && bench_rand() % 4 == 0) {
+            text[n++] = '(';
+            level++;
+        }
+        int digits = 1 + bench_rand() % 8;
+        for (int d = 0; d < digits; d++) {
+            text[n++] = identifiers ? 'a' + bench_rand() % 26 : '0' + bench_rand() % 10;
+        }
+        while (level > 0 && (n + level + 32 >= size || bench_rand() % 4 == 0)) {
+            text[n++] = ')';
+            level--;
+        }
+        if (n + level + 32 >= size) break;
+        for (int spaces = bench_rand() % 4; spaces > 0; spaces--) text[n++] = ' ';
+        text[n++] = bench_rand() % 2 ? '+' : '*';
+        for (int spaces = bench_rand() % 4; spaces > 0; spaces--) text[n++] = bench_rand() % 8 ? ' ' : '\n';
+    }
+    text[n] = '\0';
+    return text;
+}
+
+// Function to time the lexer's classifiers against each other, checking that
+// they produce the same tokens, and parse_input (one character at a time)
+// against lex_input + parse_tokens. Prints one JSON result line per case.
+static void run_lex_benchmark(const BenchOptions *options) {
+    size_t size = options->length ? (size_t)options->length : 16 << 20;
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+
+    const char *classifier_names[] = {"scalar", "sse2", "avx2"};
+    ClassifyFunction classifiers[] = {classify_scalar, NULL, NULL};
+#ifdef LL1_X86_SIMD
+    if (__builtin_cpu_supports("sse2")) classifiers[1] = classify_sse2;
+    if (__builtin_cpu_supports("avx2")) classifiers[2] = classify_avx2;
+#endif
+
+    ParseContext ctx;
+    parse_context_init(&ctx, &g);
+    TokenBuffer reference, tokens;
+    token_buffer_init(&reference);
+    token_buffer_init(&tokens);
+
+    for (int identifiers = 0; identifiers <= 1; identifiers++) {
+        char *text = generate_spaced_expression(size, identifiers);
+        size_t length = strlen(text);
+        lex_with(&g, text, length, &reference, classify_scalar);
+
+        for (int c = 0; c < 3; c++) {
+            if (!classifiers[c]) continue;
+            double best = 0;
+            for (int r = 0; r < options->repeat; r++) {
+                double start = now_seconds();
+                lex_with(&g, text, length, &tokens, classifiers[c]);
+                double elapsed = now_seconds() - start;
+                if (r == 0 || elapsed < best) best = elapsed;
+            }
+            bool same = tokens.count == reference.count
+                && memcmp(tokens.terminals, reference.terminals, tokens.count * sizeof(Symbol)) == 0
+                && memcmp(tokens.offsets, reference.offsets, tokens.count * sizeof(uint32_t)) == 0;
+            printf("{\"bench\": \"lex\", \"classifier\": \"%s\", \"operands\": \"%s\", \"bytes\": %zu, "
+                   "\"tokens\": %d, \"seconds\": %.6f, \"mb_per_sec\": %.1f, \"identical\": %s}\n",
+                   classifier_names[c], identifiers ? "identifiers" : "numbers", length, tokens.count,
+                   best, length / best / 1e6, same ? "true" : "false");
+            fflush(stdout);
+        }
+
+        // Identifiers are only tokens for the lexer, so the two parse paths
+        // are compared on numbers
+        for (int path = 0; path <= 1 && !identifiers; path++) {
+            double best = 0;
+            bool accepted = false;
+            for (int r = 0; r < options->repeat; r++) {
+                double start = now_seconds();
+                if (path == 0) {
+                    accepted = parse_input(&ctx, text, NULL);
+                } else {
+                    accepted = lex_input(&g, text, length, &tokens) && parse_tokens(&ctx, &tokens, NULL);
+                }
+                double elapsed = now_seconds() - start;
+                if (r == 0 || elapsed < best) best = elapsed;
+            }
+            printf("{\"bench\": \"lex_parse\", \"path\": \"%s\", \"bytes\": %zu, \"tokens\": %d, "
+                   "\"accepted\": %s, \"seconds\": %.6f, \"mb_per_sec\": %.1f, \"ns_per_token\": %.3f}\n",
+                   path == 0 ? "characters" : "tokens", length, reference.count, accepted ? "true" : "false",
+                   best, length / best / 1e6, best * 1e9 / reference.count);
+            fflush(stdout);
+        }
+        free(text);
+    }
+
+    // Render the table trace of a lexed identifier expression whose events
+    // overflow the ring, so the rows are rendered without the replayed stack
+    // (printed to /dev/null)
+    char *text = generate_spaced_expression(1 << 16, true);
+    TraceLog trace;
+    trace_init(&trace, TRACE_CAPACITY);
+    bool accepted = lex_input(&g, text, strlen(text), &tokens) && parse_tokens(&ctx, &tokens, &trace);
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+    double start = now_seconds();
+    render_trace(&g, &trace, text);
+    fflush(stdout);
+    double elapsed = now_seconds() - start;
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    if (null_fd >= 0) close(null_fd);
+    printf("{\"bench\": \"lex_trace\", \"bytes\": %zu, \"tokens\": %d, \"accepted\": %s, \"events\": %llu, "
+           "\"retained\": %u, \"render_seconds\": %.6f}\n",
+           strlen(text), tokens.count, accepted ? "true" : "false", (unsigned long long)trace.count,
+           trace.capacity, elapsed);
+    fflush(stdout);
+    trace_free(&trace);
+    free(text);
+
+    token_buffer_free(&reference);
+    token_buffer_free(&tokens);
+    parse_context_free(&ctx);
+    free_grammar(&g);
+}
+
+// Function to time parsing table lookups in the dense and packed layouts on
+// one sparse synthetic grammar and print one JSON result line. Half the lookups hit
+// filled cells, as a parse does; the other half are uniform, mostly errors.
+// Each lookup picks the next from its result, so the time is latency.
+static void bench_table_case(int nt_count, int t_count, int alternatives, int epsilon_percent, int repeat) {
+    const int lookups = 1 << 22;
+    Grammar g;
+    generate_sparse_grammar(&g, nt_count, t_count, alternatives, epsilon_percent);
+    compute_first(&g);
+    compute_follow(&g);
+    create_parsing_table(&g);
+    bool auto_packed = g.row_base != NULL;
+
+    // Both layouts of the same table, as shallow copies of the grammar
+    size_t cells = (size_t)g.non_terminals.count * g.terminals.count;
+    TableEntry *dense_cells = malloc((cells + 1) * sizeof(TableEntry));
+    size_t filled = 0;
+    for (size_t c = 0; c < cells; c++) {
+        dense_cells[c] = table_entry(&g, c / g.terminals.count, c % g.terminals.count);
+        filled += dense_cells[c] != NO_PRODUCTION;
+    }
+    if (!auto_packed) pack_parsing_table(&g, true);
+    Grammar dense = g, packed = g;
+    dense.parsing_table = dense_cells;
+    dense.row_base = NULL;
+
+    bool same = true;
+    for (size_t c = 0; c < cells; c++) {
+        same &= table_entry(&packed, c / g.terminals.count, c % g.terminals.count) == dense_cells[c];
+    }
+
+    // Lookup targets: even slots are filled cells, odd slots uniform
+    uint32_t *targets = malloc(lookups * sizeof(uint32_t));
+    uint32_t *filled_cells = malloc((filled + 1) * sizeof(uint32_t));
+    size_t filled_count = 0;
+    for (size_t c = 0; c < cells; c++) {
+        if (dense_cells[c] != NO_PRODUCTION) filled_cells[filled_count++] = c;
+    }
+    for (int i = 0; i < lookups; i++) {
+        targets[i] = i % 2 == 0 && filled_count ? filled_cells[bench_rand() % filled_count] : bench_rand() % cells;
+    }
+
+    double times[2] = {0, 0};
+    uint64_t checks[2] = {0, 0};
+    for (int layout = 0; layout < 2; layout++) {
+        const Grammar *view = layout ? &packed : &dense;
+        for (int r = 0; r < repeat; r++) {
+            uint64_t check = 0;
+            uint32_t i = 0;
+            double start = now_seconds();
+            for (int k = 0; k < lookups; k++) {
+                uint32_t c = targets[i];
+                TableEntry entry = layout ? lookup_entry(view, c / view->terminals.count, c % view->terminals.count, true)
+                                          : lookup_entry(view, c / view->terminals.count, c % view->terminals.count, false);
+                check += entry;
+                i = (i + 1 + (entry & 1)) & (lookups - 1);
+            }
+            double elapsed = now_seconds() - start;
+            if (r == 0 || elapsed < times[layout]) times[layout] = elapsed;
+            checks[layout] = check;
+        }
+    }
+    same &= checks[0] == checks[1];
+
+    size_t dense_bytes = cells * sizeof(TableEntry);
+    size_t packed_bytes = (size_t)packed.packed_count * sizeof(uint32_t) + (size_t)g.non_terminals.count * sizeof(int32_t);
+    printf("{\"bench\": \"table\", \"non_terminals\": %d, \"terminals\": %d, \"rules\": %d, \"filled_cells\": %zu, "
+           "\"density\": %.4f, \"dense_bytes\": %zu, \"packed_bytes\": %zu, \"auto_layout\": \"%s\", "
+           "\"dense_ns_per_lookup\": %.2f, \"packed_ns_per_lookup\": %.2f, \"identical\": %s}\n",
+           g.non_terminals.count, g.terminals.count, g.rule_count, filled, (double)filled / (cells ? cells : 1),
+           dense_bytes, packed_bytes, auto_packed ? "packed" : "dense",
+           times[0] * 1e9 / lookups, times[1] * 1e9 / lookups, same ? "true" : "false");
+    fflush(stdout);
+
+    free(targets);
+    free(filled_cells);
+    free(dense_cells);
+    free_grammar(&g);
+}
+
+// Function to run the table benchmark over a grid of grammar sizes, unless
+// given on the command line. Terminals default to as many as non-terminals,
+// so the larger tables are well past the caches.
+static void run_table_benchmark(const BenchOptions *options) {
+    static const int default_sizes[] = {250, 1000, 4000, 8000};
+    int size_count = options->non_terminals ? 1 : 4;
+
+    for (int s = 0; s < size_count; s++) {
+        int nt_count = options->non_terminals ? options->non_terminals : default_sizes[s];
+        int t_count = options->terminals ? options->terminals : nt_count;
+        bench_table_case(nt_count, t_count, options->alternatives ? options->alternatives : 4,
+                         options->epsilon_percent >= 0 ? options->epsilon_percent : 10, options->repeat);
+    }
+}
+
+// Damage the compiled grammar benchmark does to a saved file; map_grammar
+// must reject every one
+enum {
+    CORRUPT_TRUNCATED,
+    CORRUPT_MISALIGNED,
+    CORRUPT_START_SYMBOL,
+    CORRUPT_BYTE_MAP,
+    CORRUPT_SLOT,
+    CORRUPT_RULE_LHS,
+    CORRUPT_RULE_SPAN,
+    CORRUPT_ARENA,
+    CORRUPT_TABLE,
+    CORRUPT_CHAIN_INDEX,
+    CORRUPT_CHAIN,
+    CORRUPT_COUNT
+};
+
+// Function to write a copy of a compiled grammar file with one kind of damage
+static bool write_corrupt_grammar(const char *data, size_t size, int kind, const char *path) {
+    char *copy = malloc(size);
+    memcpy(copy, data, size);
+    GrammarFileHeader *header = (GrammarFileHeader *)copy;
+    ProductionRule *rules = (ProductionRule *)(copy + header->rules_offset);
+    TableEntry *table = (TableEntry *)(copy + header->table_offset);
+    uint32_t *chain_index = (uint32_t *)(copy + header->chain_index_offset);
+    size_t cells = (size_t)header->non_terminal_count * header->terminal_count;
+    switch (kind) {
+        case CORRUPT_TRUNCATED: size /= 2; break;
+        case CORRUPT_MISALIGNED: header->non_terminal_slots_offset += 110; break;
+        case CORRUPT_START_SYMBOL: header->start_symbol = header->non_terminal_count; break;
+        case CORRUPT_BYTE_MAP: ((int32_t *)(copy + header->byte_map_offset))['('] = header->terminal_count; break;
+        case CORRUPT_SLOT: ((int32_t *)(copy + header->terminal_slots_offset))[0] = header->terminal_count + 1; break;
+        case CORRUPT_RULE_LHS: rules[0].lhs = header->non_terminal_count; break;
+        case CORRUPT_RULE_SPAN: rules[0].eval_len = header->arena_count + 1; break;
+        case CORRUPT_ARENA: ((Symbol *)(copy + header->arena_offset))[0] = header->terminal_count; break;
+        case CORRUPT_TABLE: table[cells - 1] = header->rule_count; break;
+        case CORRUPT_CHAIN_INDEX:
+            for (size_t s = 0; s < cells; s++) {
+                if (chain_index[s] != CHAIN_NONE) { chain_index[s]++; break; }
+            }
+            break;
+        case CORRUPT_CHAIN: ((int32_t *)(copy + header->chain_arena_offset))[CHAIN_HEADER] = header->rule_count; break;
+    }
+    FILE *out = fopen(path, "wb");
+    bool written = out && fwrite(copy, 1, size, out) == size;
+    if (out) written &= fclose(out) == 0;
+    free(copy);
+    return written;
+}
+
+// Function to time compiling a sparse synthetic grammar against saving it
+// and mapping it back, then check that map_grammar rejects each kind of
+// damaged copy of the file
+static void bench_compiled_case(int nt_count, int t_count, int alternatives, int epsilon_percent, int repeat) {
+    char path[] = "/tmp/ll1-bench-XXXXXX";
+    char corrupt_path[] = "/tmp/ll1-bench-XXXXXX";
+    int fd = mkstemp(path);
+    int corrupt_fd = mkstemp(corrupt_path);
+    if (fd < 0 || corrupt_fd < 0) {
+        fprintf(stderr, "Error: Cannot create a temporary file\n");
+        if (fd >= 0) { close(fd); unlink(path); }
+        if (corrupt_fd >= 0) { close(corrupt_fd); unlink(corrupt_path); }
+        return;
+    }
+    close(fd);
+    close(corrupt_fd);
+
+    double compile_time = 0, map_time = 0;
+    Grammar g;
+    for (int r = 0; r < repeat; r++) {
+        double start = now_seconds();
+        generate_sparse_grammar(&g, nt_count, t_count, alternatives, epsilon_percent);
+        compute_first(&g);
+        compute_follow(&g);
+        create_parsing_table(&g);
+        double elapsed = now_seconds() - start;
+        if (r == 0 || elapsed < compile_time) compile_time = elapsed;
+        if (r < repeat - 1) free_grammar(&g);
+    }
+    bool saved = save_grammar(&g, path);
+    bool identical = saved;
+    for (int r = 0; saved && r < repeat; r++) {
+        Grammar mapped;
+        double start = now_seconds();
+        bool ok = map_grammar(&mapped, path);
+        double elapsed = now_seconds() - start;
+        if (r == 0 || elapsed < map_time) map_time = elapsed;
+        identical &= ok && mapped.rule_count == g.rule_count && mapped.chain_count == g.chain_count;
+        for (int n = 0; ok && n < g.non_terminals.count; n++) {
+            for (int t = 0; t < g.terminals.count; t++) identical &= table_entry(&mapped, n, t) == table_entry(&g, n, t);
+        }
+        if (ok) free_grammar(&mapped);
+    }
+
+    // Map each damaged copy with error messages silenced
+    size_t size = 0;
+    const char *data = saved ? map_input_file(path, &size) : NULL;
+    int rejected = 0;
+    fflush(stderr);
+    int saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) dup2(null_fd, STDERR_FILENO);
+    for (int kind = 0; data && kind < CORRUPT_COUNT; kind++) {
+        Grammar mapped;
+        if (!write_corrupt_grammar(data, size, kind, corrupt_path)) continue;
+        if (map_grammar(&mapped, corrupt_path)) {
+            free_grammar(&mapped);
+        } else {
+            rejected++;
+        }
+    }
+    dup2(saved_stderr, STDERR_FILENO);
+    close(saved_stderr);
+    if (null_fd >= 0) close(null_fd);
+
+    printf("{\"bench\": \"compiled\", \"non_terminals\": %d, \"terminals\": %d, \"rules\": %d, \"file_bytes\": %zu, "
+           "\"compile_ms\": %.3f, \"map_ms\": %.3f, \"identical\": %s, \"corrupt_cases\": %d, \"rejected\": %d}\n",
+           g.non_terminals.count, g.terminals.count, g.rule_count, size, compile_time * 1e3, map_time * 1e3,
+           identical ? "true" : "false", CORRUPT_COUNT, rejected);
+    fflush(stdout);
+
+    if (data) munmap((void *)data, size);
+    free_grammar(&g);
+    unlink(path);
+    unlink(corrupt_path);
+}
+
+// Function to run the compiled grammar benchmark over a range of grammar
+// sizes, unless given on the command line
+static void run_compiled_benchmark(const BenchOptions *options) {
+    static const int default_sizes[] = {250, 1000, 4000};
+    int size_count = options->non_terminals ? 1 : 3;
+
+    for (int s = 0; s < size_count; s++) {
+        int nt_count = options->non_terminals ? options->non_terminals : default_sizes[s];
+        int t_count = options->terminals ? options->terminals : nt_count / 2;
+        bench_compiled_case(nt_count, t_count, options->alternatives ? options->alternatives : 4,
+                            options->epsilon_percent >= 0 ? options->epsilon_percent : 10, options->repeat);
+    }
+}
+
+// Function to apply one random edit to an expression of `*length` bytes with
+// room to grow, and report the range it replaced. Edits cycle through
+// swapping an operator, wrapping an operand in parentheses, inserting a stray
+// operator and removing it again, so inputs go from valid to invalid and back.
+static void random_edit(char *text, size_t *length, int kind, size_t *stray, size_t *start, size_t *old_end, size_t *new_end) {
+    if (kind == 3) {
+        // Remove the stray operator again
+        memmove(text + *stray, text + *stray + 1, *length - *stray);
+        (*length)--;
+        *start = *stray;
+        *old_end = *stray + 1;
+        *new_end = *stray;
+        return;
+    }
+    size_t at = bench_rand() % *length;
+    char wanted = kind == 1 ? 'i' : '+';
+    while (at < *length && text[at] != wanted && (kind == 1 || text[at] != '*')) at++;
+    if (at == *length) at = 0;
+    while (text[at] != wanted && (kind == 1 || text[at] != '*')) at++;
+
+    if (kind == 0) {
+        text[at] = text[at] == '+' ? '*' : '+';
+        *start = at;
+        *old_end = at + 1;
+        *new_end = at + 1;
+    } else if (kind == 1) {
+        memmove(text + at + 3, text + at + 1, *length - at);
+        text[at] = '(';
+        text[at + 1] = 'i';
+        text[at + 2] = ')';
+        *length += 2;
+        *start = at;
+        *old_end = at + 1;
+        *new_end = at + 3;
+    } else {
+        memmove(text + at + 2, text + at + 1, *length - at);
+        text[at + 1] = '+';
+        (*length)++;
+        *stray = at + 1;
+        *start = at + 1;
+        *old_end = at + 1;
+        *new_end = at + 2;
+    }
+}
+
+// Function to time incremental reparsing against parsing from scratch on one
+// long expression under `edits` random edits, checking every result
+static void bench_incremental_case(int length, int depth, int edits, int repeat) {
+    size_t capacity = (size_t)length + depth + 4 + 2 * (size_t)edits;
+    char *text = malloc(capacity);
+    char *copy = malloc(capacity);
+    generate_expression(text, length, depth, true, false);
+    size_t initial_length = strlen(text);
+
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    ParseContext ctx;
+    parse_context_init(&ctx, &g);
+    IncrementalParse inc;
+    incremental_init(&inc, &g);
+
+    double best_full = 0, best_edit = 0;
+    uint64_t scanned = 0;
+    int mismatches = 0, accepted = 0;
+    for (int r = 0; r < repeat; r++) {
+        size_t text_length = initial_length;
+        memcpy(copy, text, initial_length + 1);
+        bench_rng_state = 2463534242u;
+        incremental_parse(&inc, copy, text_length);
+        double full_time = 0, edit_time = 0;
+        size_t stray = 0;
+        scanned = 0;
+        accepted = 0;
+        for (int e = 0; e < edits; e++) {
+            size_t start, old_end, new_end;
+            random_edit(copy, &text_length, e % 4, &stray, &start, &old_end, &new_end);
+
+            double t0 = now_seconds();
+            bool incremental = incremental_reparse(&inc, copy, text_length, start, old_end, new_end);
+            double t1 = now_seconds();
+            InputStream in;
+            stream_open_buffer(&in, copy, text_length);
+            bool full = parse_stream(&ctx, &in, NULL);
+            double t2 = now_seconds();
+
+            edit_time += t1 - t0;
+            full_time += t2 - t1;
+            scanned += inc.scanned;
+            accepted += full;
+            mismatches += incremental != full || incremental_stop_offset(&inc) != stream_offset(&in);
+        }
+        if (r == 0 || edit_time < best_edit) best_edit = edit_time;
+        if (r == 0 || full_time < best_full) best_full = full_time;
+    }
+
+    printf("{\"bench\": \"incremental\", \"length\": %zu, \"depth\": %d, \"edits\": %d, \"accepted\": %d, "
+           "\"full_us\": %.2f, \"edit_us\": %.2f, \"bytes_per_edit\": %.1f, \"speedup\": %.1f, \"mismatches\": %d}\n",
+           initial_length, depth, edits, accepted, best_full * 1e6 / edits, best_edit * 1e6 / edits,
+           (double)scanned / edits, best_full / best_edit, mismatches);
+    fflush(stdout);
+    incremental_free(&inc);
+    parse_context_free(&ctx);
+    free_grammar(&g);
+    free(text);
+    free(copy);
+}
+
+// Function to run the incremental parsing benchmark over a range of input
+// lengths, unless given on the command line
+static void run_incremental_benchmark(const BenchOptions *options) {
+    static const int default_lengths[] = {4096, 65536, 1 << 20};
+    int length_count = options->length ? 1 : 3;
+    for (int l = 0; l < length_count; l++) {
+        bench_incremental_case(options->length ? options->length : default_lengths[l], options->depth ? options->depth : 8,
+                               options->count ? options->count : 1000, options->repeat);
+    }
+}
+
+typedef struct {
+    SharedGrammar *shared;
+    char **inputs;
+    int input_count;
+    double seconds;                         // How long to keep parsing
+    atomic_bool *stop;                      // Set by the last reader to finish
+    uint64_t parses;
+    int mismatches;
+    bool plain;                             // Parse the first grammar directly
+} ReloadReader;
+
+// Function to parse the inputs round-robin with whichever grammar is current,
+// checking each result against the grammar the parse actually used: only the
+// variant grammar has '-'
+static void *reload_reader_thread(void *arg) {
+    ReloadReader *reader = arg;
+    ParseContext ctx;
+    parse_context_init(&ctx, reader->plain ? shared_grammar_acquire(reader->shared) : NULL);
+    double end = now_seconds() + reader->seconds;
+    int n = 0;
+    do {
+        for (int batch = 0; batch < 256; batch++, n = (n + 1) % reader->input_count) {
+            const char *input = reader->inputs[n];
+            bool has_minus = strchr(input, '-') != NULL;
+            if (reader->plain) {
+                bool accepted = parse_input(&ctx, input, NULL);
+                reader->mismatches += accepted != !has_minus;
+            } else {
+                ctx.grammar = shared_grammar_acquire(reader->shared);
+                bool accepted = parse_input(&ctx, input, NULL);
+                bool variant = get_terminal_index(ctx.grammar, '-') >= 0;
+                shared_grammar_release(reader->shared);
+                reader->mismatches += accepted != (variant || !has_minus);
+            }
+        }
+        reader->parses += 256;
+    } while (now_seconds() < end);
+    parse_context_free(&ctx);
+    if (reader->plain) shared_grammar_release(reader->shared);
+    atomic_store(reader->stop, true);
+    return NULL;
+}
+
+// Function to build the expression grammar, or its variant with binary '-'
+static void build_reload_grammar(Grammar *g, bool variant) {
+    grammar_init(g);
+    add_expression_grammar(g);
+    if (variant) add_rule(g, 'X', "-T{sub}X");
+    compile_grammar(g);
+}
+
+// Function to time parsing through a shared grammar: directly, through
+// acquire/release with no reloads, and while another thread keeps publishing
+// the grammar and its variant alternately
+static void run_reload_benchmark(const BenchOptions *options, int threads) {
+    int count = options->count ? options->count : 4096;
+    int length = options->length ? options->length : 64;
+    if (threads <= 0) threads = default_thread_count();
+    double seconds = 0.25 * options->repeat;
+
+    bench_rng_state = 2463534242u;
+    char **inputs = malloc(count * sizeof(char *));
+    for (int n = 0; n < count; n++) {
+        inputs[n] = malloc(length + 8);
+        generate_expression(inputs[n], length, options->depth ? options->depth : 4, true, false);
+        char *op = strchr(inputs[n], '+');
+        if (op && n % 2) *op = '-';
+    }
+
+    static const char *const modes[] = {"direct", "shared", "reloading"};
+    for (int mode = 0; mode < 3; mode++) {
+        Grammar g;
+        build_reload_grammar(&g, false);
+        SharedGrammar *shared = shared_grammar_create(&g);
+        atomic_bool stop;
+        atomic_init(&stop, false);
+        ReloadReader *readers = calloc(threads, sizeof(ReloadReader));
+        pthread_t *ids = malloc(threads * sizeof(pthread_t));
+        double start = now_seconds();
+        for (int t = 0; t < threads; t++) {
+            readers[t] = (ReloadReader){shared, inputs, count, seconds, &stop, 0, 0, mode == 0};
+            pthread_create(&ids[t], NULL, reload_reader_thread, &readers[t]);
+        }
+
+        // Rebuild and publish on this thread until the readers are done
+        int publishes = 0;
+        double rebuild_time = 0;
+        while (mode == 2 && !atomic_load(&stop)) {
+            double t0 = now_seconds();
+            Grammar next;
+            build_reload_grammar(&next, publishes % 2 == 0);
+            rebuild_time += now_seconds() - t0;
+            shared_grammar_publish(shared, &next);
+            publishes++;
+            usleep(1000);
+        }
+
+        uint64_t parses = 0;
+        int mismatches = 0;
+        for (int t = 0; t < threads; t++) {
+            pthread_join(ids[t], NULL);
+            parses += readers[t].parses;
+            mismatches += readers[t].mismatches;
+        }
+        double elapsed = now_seconds() - start;
+        int pending = shared_grammar_reclaim(shared);
+
+        printf("{\"bench\": \"reload\", \"mode\": \"%s\", \"threads\": %d, \"inputs\": %d, \"length\": %d, "
+               "\"parses\": %llu, \"parses_per_sec\": %.0f, \"publishes\": %d, \"rebuild_us\": %.1f, "
+               "\"pending_after_reclaim\": %d, \"mismatches\": %d}\n",
+               modes[mode], threads, count, length, (unsigned long long)parses, parses / elapsed, publishes,
+               publishes ? rebuild_time * 1e6 / publishes : 0.0, pending, mismatches);
+        fflush(stdout);
+        shared_grammar_free(shared);
+        free(readers);
+        free(ids);
+    }
+    for (int n = 0; n < count; n++) free(inputs[n]);
+    free(inputs);
+}
+
+// Function to time parse_parallel against parse_stream on one long valid and
+// one long invalid expression, for each thread count, checking every result
+static void run_parallel_benchmark(const BenchOptions *options, int threads) {
+    static const int default_threads[] = {1, 2, 4, 8};
+    int length = options->length ? options->length : 1 << 24;
+    int depth = options->depth ? options->depth : 8;
+    int thread_count = threads > 0 ? 1 : 4;
+
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    ParseContext ctx;
+    parse_context_init(&ctx, &g);
+    char *text = malloc((size_t)length + depth + 4);
+
+    for (int valid = 1; valid >= 0; valid--) {
+        bench_rng_state = 2463534242u;
+        generate_expression(text, length, depth, valid, false);
+        size_t text_length = strlen(text);
+
+        double sequential = 0;
+        uint64_t stop_offset = 0;
+        bool accepted = false;
+        for (int r = 0; r < options->repeat; r++) {
+            InputStream in;
+            stream_open_buffer(&in, text, text_length);
+            double start = now_seconds();
+            accepted = parse_stream(&ctx, &in, NULL);
+            double elapsed = now_seconds() - start;
+            stop_offset = stream_offset(&in);
+            if (r == 0 || elapsed < sequential) sequential = elapsed;
+        }
+
+        for (int t = 0; t < thread_count; t++) {
+            int workers = threads > 0 ? threads : default_threads[t];
+            double best = 0;
+            ParallelResult result;
+            int mismatches = 0;
+            for (int r = 0; r < options->repeat; r++) {
+                double start = now_seconds();
+                parse_parallel(&g, text, text_length, workers, &result);
+                double elapsed = now_seconds() - start;
+                mismatches += result.accepted != accepted || result.stop_offset != stop_offset;
+                if (r == 0 || elapsed < best) best = elapsed;
+            }
+            printf("{\"bench\": \"parallel\", \"bytes\": %zu, \"depth\": %d, \"valid\": %s, \"threads\": %d, "
+                   "\"segments\": %d, \"reparsed\": %d, \"sequential_ms\": %.2f, \"parallel_ms\": %.2f, "
+                   "\"speedup\": %.2f, \"accepted\": %s, \"mismatches\": %d}\n",
+                   text_length, depth, valid ? "true" : "false", workers, result.segments, result.reparsed,
+                   sequential * 1e3, best * 1e3, sequential / best, accepted ? "true" : "false", mismatches);
+            fflush(stdout);
+        }
+    }
+
+    free(text);
+    parse_context_free(&ctx);
+    free_grammar(&g);
+}
+
+typedef struct {
+    ResultCache *cache;             // NULL to parse every request
+    const Grammar *g;
+    char *const *inputs;
+    const uint32_t *requests;       // Input of each request
+    int request_count;
+    bool evaluate;
+    const EvalStatus *statuses;     // Expected result of each input
+    const int64_t *values;
+    int mismatches;
+} CacheClient;
+
+// Function to answer one client's requests, checking every result
+static void *cache_client_thread(void *arg) {
+    CacheClient *client = arg;
+    ParseContext ctx;
+    parse_context_init(&ctx, client->g);
+    for (int r = 0; r < client->request_count; r++) {
+        uint32_t n = client->requests[r];
+        const char *input = client->inputs[n];
+        if (client->evaluate) {
+            int64_t value = 0;
+            EvalStatus status = client->cache ? cached_evaluate_input(client->cache, &ctx, input, &value)
+                                              : evaluate_input(&ctx, input, NULL, &value);
+            client->mismatches += status != client->statuses[n] || (status == EVAL_OK && value != client->values[n]);
+        } else {
+            bool accepted = client->cache ? cached_parse_input(client->cache, &ctx, input)
+                                          : parse_input(&ctx, input, NULL);
+            client->mismatches += accepted != (client->statuses[n] != EVAL_REJECTED);
+        }
+    }
+    parse_context_free(&ctx);
+    return NULL;
+}
+
+// Function to time the result cache on Zipf-distributed requests (the k-th
+// most popular input is asked for in proportion to 1/k) from `threads`
+// clients, with no cache and with caches of a sixteenth, a quarter and twice
+// the bytes of all distinct inputs
+static void run_cache_benchmark(const BenchOptions *options, int threads) {
+    int distinct = options->count ? options->count : 100000;
+    int length = options->length ? options->length : 64;
+    int per_client = 200000 * options->repeat;
+    if (threads <= 0) threads = default_thread_count();
+
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    ParseContext ctx;
+    parse_context_init(&ctx, &g);
+
+    // Literal operands so that evaluation has values to cache; one input in
+    // five is invalid
+    bench_rng_state = 2463534242u;
+    char **inputs = malloc(distinct * sizeof(char *));
+    EvalStatus *statuses = malloc(distinct * sizeof(EvalStatus));
+    int64_t *values = malloc(distinct * sizeof(int64_t));
+    size_t working_set = 0;
+    for (int n = 0; n < distinct; n++) {
+        inputs[n] = malloc(length + options->depth + 8);
+        generate_expression(inputs[n], length, options->depth ? options->depth : 4, n % 5 != 0, true);
+        statuses[n] = evaluate_input(&ctx, inputs[n], NULL, &values[n]);
+        working_set += sizeof(CacheEntry) + strlen(inputs[n]);
+    }
+    double *cdf = malloc(distinct * sizeof(double));
+    double total = 0;
+    for (int n = 0; n < distinct; n++) cdf[n] = total += 1.0 / (n + 1);
+    uint32_t *requests = malloc((size_t)threads * per_client * sizeof(uint32_t));
+    for (size_t r = 0; r < (size_t)threads * per_client; r++) {
+        double u = (bench_rand() + 0.5) / 4294967296.0 * total;
+        int lo = 0, hi = distinct - 1;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (cdf[mid] < u) lo = mid + 1; else hi = mid;
+        }
+        requests[r] = lo;
+    }
+
+    static const size_t fractions[] = {0, 1, 4, 32};   // Sixteenths of the working set
+    for (int evaluate = 0; evaluate <= 1; evaluate++) {
+        for (int f = 0; f < 4; f++) {
+            size_t capacity = working_set * fractions[f] / 16;
+            ResultCache *cache = capacity ? result_cache_create(capacity, 0) : NULL;
+            CacheClient *clients = malloc(threads * sizeof(CacheClient));
+            pthread_t *ids = malloc(threads * sizeof(pthread_t));
+            double start = now_seconds();
+            for (int t = 0; t < threads; t++) {
+                clients[t] = (CacheClient){cache, &g, inputs, requests + (size_t)t * per_client, per_client,
+                                           evaluate, statuses, values, 0};
+                pthread_create(&ids[t], NULL, cache_client_thread, &clients[t]);
+            }
+            int mismatches = 0;
+            for (int t = 0; t < threads; t++) {
+                pthread_join(ids[t], NULL);
+                mismatches += clients[t].mismatches;
+            }
+            double elapsed = now_seconds() - start;
+
+            CacheStats stats = {0};
+            if (cache) result_cache_stats(cache, &stats);
+            uint64_t request_total = (uint64_t)threads * per_client;
+            printf("{\"bench\": \"cache\", \"mode\": \"%s\", \"threads\": %d, \"distinct\": %d, \"length\": %d, "
+                   "\"capacity_kib\": %zu, \"requests\": %llu, \"hit_rate\": %.4f, \"evictions\": %llu, "
+                   "\"ns_per_request\": %.1f, \"mismatches\": %d}\n",
+                   evaluate ? "eval" : "parse", threads, distinct, length, capacity >> 10,
+                   (unsigned long long)request_total, stats.lookups ? (double)stats.hits / stats.lookups : 0.0,
+                   (unsigned long long)stats.evictions, elapsed * 1e9 / request_total, mismatches);
+            fflush(stdout);
+            if (cache) result_cache_free(cache);
+            free(clients);
+            free(ids);
+        }
+    }
+
+    for (int n = 0; n < distinct; n++) free(inputs[n]);
+    free(inputs);
+    free(statuses);
+    free(values);
+    free(cdf);
+    free(requests);
+    parse_context_free(&ctx);
+    free_grammar(&g);
+}
+
+// Function to run the grammar benchmark over a grid of sizes and epsilon
+// densities, unless given on the command line
+static void run_grammar_benchmark(const BenchOptions *options, int threads) {
+    static const int default_sizes[] = {250, 1000, 4000};
+    static const int default_epsilons[] = {0, 20, 50};
+    int size_count = options->non_terminals ? 1 : 3;
+    int epsilon_count = options->epsilon_percent >= 0 ? 1 : 3;
+
+    if (threads <= 0) threads = default_thread_count();
+    for (int s = 0; s < size_count; s++) {
+        int nt_count = options->non_terminals ? options->non_terminals : default_sizes[s];
+        int t_count = options->terminals ? options->terminals : nt_count / 2;
+        for (int e = 0; e < epsilon_count; e++) {
+            int epsilon = options->epsilon_percent >= 0 ? options->epsilon_percent : default_epsilons[e];
+            bench_grammar_case(nt_count, t_count, options->alternatives ? options->alternatives : 4, epsilon,
+                               options->span ? options->span : 4, options->cycle_percent, threads, options->repeat);
+        }
+    }
+}
+
+// Regression checks run by --check: each prints "ok" or "FAIL" and a name.
+// Unlike the benchmarks they take no timings and stay small, so a whole run
+// takes seconds, also under the sanitizers.
+static int check_failures;
+
+static void check(bool passed, const char *name) {
+    printf("%s %s\n", passed ? "ok  " : "FAIL", name);
+    fflush(stdout);
+    if (!passed) check_failures++;
+}
+
+// Function to send stderr to /dev/null while a check expects error messages;
+// returns what restore_stderr needs
+static int silence_stderr(void) {
+    fflush(stderr);
+    int saved = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    return saved;
+}
+
+static void restore_stderr(int saved) {
+    fflush(stderr);
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+}
+
+// Function to write a check's input file
+static bool write_text_file(const char *path, const char *text) {
+    FILE *out = fopen(path, "w");
+    bool written = out && fputs(text, out) >= 0;
+    if (out) written &= fclose(out) == 0;
+    return written;
+}
+
+// Function to check that a compiled grammar maps back and that every kind
+// of damaged copy is rejected
+static void check_compiled_files(const char *dir) {
+    static const char *const names[CORRUPT_COUNT] = {
+        "a truncated file", "a misaligned section", "a bad start symbol", "a bad byte map", "a bad name slot",
+        "a bad rule lhs", "a bad rule span", "a bad arena symbol", "a bad table entry", "a bad chain index",
+        "a bad chain record"};
+    char path[256], corrupt_path[256], name[96];
+    snprintf(path, sizeof(path), "%s/expr.ll1", dir);
+    snprintf(corrupt_path, sizeof(corrupt_path), "%s/corrupt.ll1", dir);
+
+    Grammar g, mapped;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    bool saved = save_grammar(&g, path);
+    check(saved, "compiled: save the built-in grammar");
+    bool ok = saved && map_grammar(&mapped, path);
+    if (ok) {
+        ParseContext ctx;
+        parse_context_init(&ctx, &mapped);
+        ok = parse_input(&ctx, "(1+2)*i", NULL) && !parse_input(&ctx, "i+", NULL);
+        parse_context_free(&ctx);
+        free_grammar(&mapped);
+    }
+    check(ok, "compiled: the mapped grammar parses like the original");
+    free_grammar(&g);
+
+    size_t size = 0;
+    const char *data = saved ? map_input_file(path, &size) : NULL;
+    for (int kind = 0; data && kind < CORRUPT_COUNT; kind++) {
+        bool written = write_corrupt_grammar(data, size, kind, corrupt_path);
+        int saved_stderr = silence_stderr();
+        bool loaded = written && map_grammar(&mapped, corrupt_path);
+        restore_stderr(saved_stderr);
+        if (loaded) free_grammar(&mapped);
+        snprintf(name, sizeof(name), "compiled: reject %s", names[kind]);
+        check(written && !loaded, name);
+    }
+    if (data) munmap((void *)data, size);
+    unlink(path);
+    unlink(corrupt_path);
+}
+
+// Function to check that grammar files with no productions or an LL(1)
+// conflict are refused, and a good one is not
+static void check_grammar_files(const char *dir) {
+    static const struct {
+        const char *name;
+        const char *text;
+        bool loads;
+        bool compiles;
+    } cases[] = {
+        {"grammar files: reject an empty file", "", false, false},
+        {"grammar files: reject a file of comments and %literal", "# nothing\n%literal n\n", false, false},
+        {"grammar files: refuse an LL(1) conflict", "E -> E + i | i\n", true, false},
+        {"grammar files: accept an LL(1) grammar", "E -> i X\nX -> + i X | e\n", true, true},
+    };
+    char path[256];
+    snprintf(path, sizeof(path), "%s/case.grammar", dir);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        Grammar g;
+        grammar_init(&g);
+        int saved_stderr = silence_stderr();
+        bool loaded = write_text_file(path, cases[c].text) && load_grammar(&g, path);
+        bool compiled = loaded && compile_grammar(&g);
+        restore_stderr(saved_stderr);
+        bool passed = loaded == cases[c].loads && compiled == cases[c].compiles;
+        if (loaded && !compiled) {
+            passed &= g.conflict_lhs == get_non_terminal_index(&g, "E")
+                   && g.conflict_terminal == get_terminal_index(&g, 'i');
+        }
+        if (compiled) {
+            ParseContext ctx;
+            parse_context_init(&ctx, &g);
+            passed &= parse_input(&ctx, "i+i", NULL);
+            parse_context_free(&ctx);
+        }
+        free_grammar(&g);
+        check(passed, cases[c].name);
+    }
+    unlink(path);
+}
+
+// Function to check that a reload keeps the current grammar when the file
+// is empty, not LL(1) or damaged, and publishes a good one
+static void check_reload(const char *dir) {
+    char path[256], compiled_path[256];
+    snprintf(path, sizeof(path), "%s/watched.grammar", dir);
+    snprintf(compiled_path, sizeof(compiled_path), "%s/watched.ll1", dir);
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    bool saved = save_grammar(&g, compiled_path);
+    SharedGrammar *shared = shared_grammar_create(&g);
+    ParseContext ctx;
+    parse_context_init(&ctx, NULL);
+
+    static const struct {
+        const char *name;
+        const char *text;
+    } bad[] = {
+        {"reload: keep the grammar when the file is emptied", ""},
+        {"reload: keep the grammar when the file is not LL(1)", "E -> E + i | i\n"},
+        {"reload: keep the grammar when the file is malformed", "E = i\n"},
+    };
+    for (size_t c = 0; c < sizeof(bad) / sizeof(bad[0]); c++) {
+        uint64_t version = shared_grammar_version(shared);
+        int saved_stderr = silence_stderr();
+        bool reloaded = !write_text_file(path, bad[c].text) || shared_grammar_reload(shared, path);
+        restore_stderr(saved_stderr);
+        check(!reloaded && shared_grammar_version(shared) == version && shared_parse_input(shared, &ctx, "i+i", NULL),
+              bad[c].name);
+    }
+
+    if (saved) {
+        // Cut the compiled file short in place, as a copy caught mid-write is
+        FILE *file = fopen(compiled_path, "r+");
+        bool truncated = file && ftruncate(fileno(file), 100) == 0;
+        if (file) fclose(file);
+        uint64_t version = shared_grammar_version(shared);
+        int saved_stderr = silence_stderr();
+        bool reloaded = !truncated || shared_grammar_reload(shared, compiled_path);
+        restore_stderr(saved_stderr);
+        check(!reloaded && shared_grammar_version(shared) == version && shared_parse_input(shared, &ctx, "i+i", NULL),
+              "reload: keep the grammar when the compiled file is truncated");
+    }
+
+    uint64_t version = shared_grammar_version(shared);
+    bool reloaded = write_text_file(path, "E -> i\n") && shared_grammar_reload(shared, path);
+    check(reloaded && shared_grammar_version(shared) == version + 1 && shared_parse_input(shared, &ctx, "i", NULL)
+          && !shared_parse_input(shared, &ctx, "i+i", NULL), "reload: publish a good grammar");
+
+    parse_context_free(&ctx);
+    shared_grammar_free(shared);
+    unlink(path);
+    unlink(compiled_path);
+}
+
+#ifdef LL1_PROFILE
+// Function to write a grammar file of `count` non-terminals, each matching
+// its own single-character terminal and then optionally the next one
+static void write_chain_grammar(const char *path, int count) {
+    static const char names[] = "abcdfghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    FILE *out = fopen(path, "w");
+    if (!out) return;
+    for (int i = 0; i < count - 1; i++) fprintf(out, "N%d -> %c N%d | e\n", i, names[i], i + 1);
+    fprintf(out, "N%d -> %c\n", count - 1, names[count - 1]);
+    fclose(out);
+}
+
+// Function to write a grammar's profile to a string for a check
+static char *profile_json(const Grammar *g) {
+    char *text = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&text, &size);
+    if (!out) return NULL;
+    profile_write_json(g, out);
+    fclose(out);
+    return text;
+}
+
+// Function to check that publishing a grammar takes its counters along, and
+// that a larger grammar built in the same struct afterwards starts afresh
+static void check_profile(const char *dir) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/chain.grammar", dir);
+    write_chain_grammar(path, 61);
+
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    ParseContext ctx;
+    parse_context_init(&ctx, &g);
+    parse_input(&ctx, "i+i", NULL);
+    SharedGrammar *shared = shared_grammar_create(&g);
+
+    grammar_init(&g);
+    bool built = load_grammar(&g, path) && compile_grammar(&g);
+    ctx.grammar = &g;
+    bool accepted = built && parse_input(&ctx, "abcdfghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789", NULL);
+    char *reused = profile_json(&g);
+    char *published = profile_json(shared_grammar_acquire(shared));
+    shared_grammar_release(shared);
+
+    check(accepted && reused && strstr(reused, "\"inputs\": 1,") != NULL,
+          "profile: a grammar built where a published one was counts from zero");
+    check(published && strstr(published, "\"inputs\": 1,") && strstr(published, "\"compute_first\": {\"calls\": 1,"),
+          "profile: a published grammar keeps its counters and phase times");
+    free(reused);
+    free(published);
+    parse_context_free(&ctx);
+    free_grammar(&g);
+    shared_grammar_free(shared);
+    unlink(path);
+}
+#endif
+
+// Function to check incremental reparsing, parallel parsing and the result
+// cache against plain parsing, as their benchmarks do at scale
+static void check_equivalence(void) {
+    Grammar g;
+    grammar_init(&g);
+    add_expression_grammar(&g);
+    compile_grammar(&g);
+    ParseContext ctx;
+    parse_context_init(&ctx, &g);
+
+    // Incremental: random edits to one expression
+    const int length = 1 << 16, edits = 400;
+    char *text = malloc(length + 16 + 2 * edits);
+    bench_rng_state = 2463534242u;
+    generate_expression(text, length, 8, true, false);
+    size_t text_length = strlen(text), stray = 0;
+    IncrementalParse inc;
+    incremental_init(&inc, &g);
+    incremental_parse(&inc, text, text_length);
+    int mismatches = 0;
+    for (int e = 0; e < edits; e++) {
+        size_t start, old_end, new_end;
+        random_edit(text, &text_length, e % 4, &stray, &start, &old_end, &new_end);
+        bool incremental = incremental_reparse(&inc, text, text_length, start, old_end, new_end);
+        InputStream in;
+        stream_open_buffer(&in, text, text_length);
+        bool full = parse_stream(&ctx, &in, NULL);
+        mismatches += incremental != full || incremental_stop_offset(&inc) != stream_offset(&in);
+    }
+    incremental_free(&inc);
+    free(text);
+    check(mismatches == 0, "incremental: reparsing after edits matches parsing from scratch");
+
+    // Parallel: a valid and an invalid expression long enough to split
+    const int long_length = 6 * PARALLEL_SEGMENT;
+    text = malloc(long_length + 16);
+    mismatches = 0;
+    for (int valid = 1; valid >= 0; valid--) {
+        bench_rng_state = 2463534242u;
+        generate_expression(text, long_length, 8, valid, false);
+        text_length = strlen(text);
+        InputStream in;
+        stream_open_buffer(&in, text, text_length);
+        bool accepted = parse_stream(&ctx, &in, NULL);
+        ParallelResult result;
+        parse_parallel(&g, text, text_length, 4, &result);
+        mismatches += result.accepted != accepted || result.stop_offset != stream_offset(&in) || result.segments < 2;
+    }
+    free(text);
+    check(mismatches == 0, "parallel: a split parse matches parsing in one piece");
+
+    // Cache: more inputs than fit, each asked for twice
+    ResultCache *cache = result_cache_create(16 << 10, 2);
+    char input[80];
+    mismatches = 0;
+    bench_rng_state = 2463534242u;
+    for (int n = 0; n < 2000; n++) {
+        generate_expression(input, 48, 4, n % 3 != 0, true);
+        for (int pass = 0; pass < 2; pass++) {
+            int64_t value = 0, cached_value = 0;
+            EvalStatus status = evaluate_input(&ctx, input, NULL, &value);
+            EvalStatus cached_status = cached_evaluate_input(cache, &ctx, input, &cached_value);
+            mismatches += cached_parse_input(cache, &ctx, input) != parse_input(&ctx, input, NULL);
+            mismatches += cached_status != status || (status == EVAL_OK && cached_value != value);
+        }
+    }
+    CacheStats stats;
+    result_cache_stats(cache, &stats);
+    result_cache_free(cache);
+    check(mismatches == 0 && stats.hits > 0 && stats.evictions > 0, "cache: hits and evictions return what parsing does");
+
+    parse_context_free(&ctx);
+    free_grammar(&g);
+}
+
+// Function to run every regression check; returns the exit status
+static int run_checks(void) {
+    char dir[] = "/tmp/ll1-check-XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "Error: Cannot create a temporary directory\n");
+        return 1;
+    }
+    check_compiled_files(dir);
+    check_grammar_files(dir);
+    check_reload(dir);
+#ifdef LL1_PROFILE
+    check_profile(dir);
+#endif
+    check_equivalence();
+    rmdir(dir);
+    printf("%d check%s failed\n", check_failures, check_failures == 1 ? "" : "s");
+    return check_failures ? 1 : 0;
+}
+
+// Background reloader of a watched grammar file
+typedef struct {
+    SharedGrammar *shared;
+    const char *path;
+    atomic_bool done;
+} GrammarWatcher;
+
+// Function to poll the grammar file and reload it in the background whenever
+// its modification time or size changes
+static void *watch_grammar_thread(void *arg) {
+    GrammarWatcher *watcher = arg;
+    struct stat last;
+    if (stat(watcher->path, &last) != 0) memset(&last, 0, sizeof(last));
+    while (!atomic_load(&watcher->done)) {
+        usleep(100000);
+        struct stat now;
+        if (stat(watcher->path, &now) != 0) continue;
+        if (now.st_mtim.tv_sec == last.st_mtim.tv_sec && now.st_mtim.tv_nsec == last.st_mtim.tv_nsec &&
+            now.st_size == last.st_size) continue;
+        last = now;
+        if (shared_grammar_reload(watcher->shared, watcher->path)) {
+            fprintf(stderr, "Reloaded grammar '%s' (version %llu)\n", watcher->path,
+                    (unsigned long long)shared_grammar_version(watcher->shared));
+        } else {
+            fprintf(stderr, "Keeping the previous grammar\n");
+        }
+    }
+    return NULL;
+}
+
+// Function to validate stdin line by line while a background thread reloads
+// the grammar file on change; each line uses the grammar current when it
+// starts. With a cache, repeated lines are answered from it.
+static int run_watch(Grammar *g, const char *path, ResultCache *cache) {
+    GrammarWatcher watcher = {shared_grammar_create(g), path, false};
+    pthread_t id;
+    pthread_create(&id, NULL, watch_grammar_thread, &watcher);
+
+    ParseContext ctx;
+    parse_context_init(&ctx, NULL);
+    char *line = NULL;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, stdin)) >= 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        bool accepted;
+        if (cache) {
+            ctx.grammar = shared_grammar_acquire(watcher.shared);
+            accepted = cached_parse_input(cache, &ctx, line);
+            shared_grammar_release(watcher.shared);
+        } else {
+            accepted = shared_parse_input(watcher.shared, &ctx, line, NULL);
+        }
+        printf("%s\t%s\n", accepted ? "ACCEPTED" : "REJECTED", line);
+        fflush(stdout);
+    }
+    free(line);
+
+    atomic_store(&watcher.done, true);
+    pthread_join(id, NULL);
+    parse_context_free(&ctx);
+    shared_grammar_free(watcher.shared);
+    if (cache) {
+        CacheStats stats;
+        result_cache_stats(cache, &stats);
+        fprintf(stderr, "Cache: %llu lookups, %llu hits (%.1f%%), %llu entries, %llu evictions\n",
+                (unsigned long long)stats.lookups, (unsigned long long)stats.hits,
+                stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0,
+                (unsigned long long)stats.entries, (unsigned long long)stats.evictions);
+        result_cache_free(cache);
+    }
+    return 0;
+}
+
+// Function to write the merged profile of a grammar to a file
+static bool write_profile(const Grammar *g, const char *path) {
+    FILE *out = fopen(path, "w");
+    bool written = out && profile_write_json(g, out);
+    if (out) written &= fclose(out) == 0;
+    if (!written) fprintf(stderr, "Error: Cannot write profile file '%s'\n", path);
+    return written;
+}
+
+int main(int argc, char **argv) {
+    const char *grammar_path = NULL;
+    const char *stream_path = NULL;
+    const char *batch_path = NULL;
+    const char *parallel_path = NULL;
+    const char *compile_path = NULL;
+    const char *generate_path = NULL;
+    const char *parser_name = "grammar";
+    const char *bitmap_path = NULL;
+    const char *profile_path = NULL;
+    int threads = 0;
+    bool streaming = false;
+    bool build_tree = false;
+    bool evaluate = false;
+    bool use_lexer = false;
+    bool watch = false;
+    size_t cache_kib = 0;
+    TraceLevel trace_level = TRACE_TABLE;
+    const char *bench = NULL;
+    bool run_check = false;
+    BenchOptions bench_options = {0, 0, 0, 0, 0, 0, -1, 0, 0, 3};
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            bench = "fixpoint";
+        } else if (strncmp(argv[i], "--bench=", 8) == 0) {
+            bench = argv[i] + 8;
+        } else if (strcmp(argv[i], "--check") == 0) {
+            run_check = true;
+        } else if (strncmp(argv[i], "--length=", 9) == 0) {
+            bench_options.length = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--depth=", 8) == 0) {
+            bench_options.depth = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--count=", 8) == 0) {
+            bench_options.count = atoi(argv[i] + 8);
+        } else if (strncmp(argv[i], "--non-terminals=", 16) == 0) {
+            bench_options.non_terminals = atoi(argv[i] + 16);
+        } else if (strncmp(argv[i], "--terminals=", 12) == 0) {
+            bench_options.terminals = atoi(argv[i] + 12);
+        } else if (strncmp(argv[i], "--alternatives=", 15) == 0) {
+            bench_options.alternatives = atoi(argv[i] + 15);
+        } else if (strncmp(argv[i], "--epsilon=", 10) == 0) {
+            bench_options.epsilon_percent = atoi(argv[i] + 10);
+        } else if (strncmp(argv[i], "--span=", 7) == 0) {
+            bench_options.span = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--cycles=", 9) == 0) {
+            bench_options.cycle_percent = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--repeat=", 9) == 0) {
+            bench_options.repeat = atoi(argv[i] + 9);
+        } else if (strcmp(argv[i], "--trace=off") == 0) {
+            trace_level = TRACE_OFF;
+        } else if (strcmp(argv[i], "--trace=binary") == 0) {
+            trace_level = TRACE_BINARY;
+        } else if (strcmp(argv[i], "--trace=table") == 0) {
+            trace_level = TRACE_TABLE;
+        } else if (strcmp(argv[i], "--tree") == 0) {
+            build_tree = true;
+        } else if (strcmp(argv[i], "--eval") == 0) {
+            evaluate = true;
+        } else if (strcmp(argv[i], "--lex") == 0) {
+            use_lexer = true;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = true;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+            cache_kib = strtoull(argv[i] + 8, NULL, 10);
+        } else if (strncmp(argv[i], "--stream", 8) == 0 && (argv[i][8] == '\0' || argv[i][8] == '=')) {
+            streaming = true;
+            if (argv[i][8] == '=') stream_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--batch=", 8) == 0) {
+            batch_path = argv[i] + 8;
+        } else if (strncmp(argv[i], "--parallel=", 11) == 0) {
+            parallel_path = argv[i] + 11;
+        } else if (strncmp(argv[i], "--bitmap=", 9) == 0) {
+            bitmap_path = argv[i] + 9;
+        } else if (strncmp(argv[i], "--compile=", 10) == 0) {
+            compile_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--generate=", 11) == 0) {
+            generate_path = argv[i] + 11;
+        } else if (strncmp(argv[i], "--name=", 7) == 0) {
+            parser_name = argv[i] + 7;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            threads = atoi(argv[i] + 10);
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [--trace=off|binary|table] [--tree|--eval|--lex] [--stream[=input-file]] [--profile=output-file] [grammar-file]\n"
+                            "       %s --batch=input-file [--threads=N] [--bitmap=output-file] [--profile=output-file] [grammar-file]\n"
+                            "       %s --parallel=input-file [--threads=N] [grammar-file]\n"
+                            "       %s --compile=output-file [grammar-file]\n"
+                            "       %s --generate=output-file [--name=prefix] [grammar-file]\n"
+                            "       %s --watch [--cache=KiB] grammar-file\n"
+                            "       %s --bench[=fixpoint|parse|eval|lex|grammar|table|compiled|incremental|reload|parallel|cache] [benchmark options]\n"
+                            "       %s --check\n",
+                    argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return 1;
+        } else {
+            grammar_path = argv[i];
+        }
+    }
+
+    if (evaluate + build_tree + use_lexer > 1) {
+        fprintf(stderr, "Error: Use only one of --eval, --tree and --lex\n");
+        return 1;
+    }
+    if (use_lexer && streaming) {
+        fprintf(stderr, "Error: --lex parses a single input line, not a stream\n");
+        return 1;
+    }
+    if (watch && !grammar_path) {
+        fprintf(stderr, "Error: --watch needs a grammar file to watch\n");
+        return 1;
+    }
+    if (cache_kib && !watch) {
+        fprintf(stderr, "Error: --cache applies to --watch\n");
+        return 1;
+    }
+#ifndef LL1_PROFILE
+    if (profile_path) {
+        fprintf(stderr, "Error: --profile needs a build with -DLL1_PROFILE\n");
+        return 1;
+    }
+#endif
+
+    if (run_check) return run_checks();
+
+    if (bench) {
+        if (bench_options.repeat < 1) bench_options.repeat = 1;
+        if (strcmp(bench, "fixpoint") == 0) {
+            run_benchmark(&bench_options, threads);
+        } else if (strcmp(bench, "parse") == 0) {
+            run_parse_benchmark(&bench_options, false);
+        } else if (strcmp(bench, "eval") == 0) {
+            run_parse_benchmark(&bench_options, true);
+        } else if (strcmp(bench, "lex") == 0) {
+            run_lex_benchmark(&bench_options);
+        } else if (strcmp(bench, "grammar") == 0) {
+            run_grammar_benchmark(&bench_options, threads);
+        } else if (strcmp(bench, "table") == 0) {
+            run_table_benchmark(&bench_options);
+        } else if (strcmp(bench, "compiled") == 0) {
+            run_compiled_benchmark(&bench_options);
+        } else if (strcmp(bench, "incremental") == 0) {
+            run_incremental_benchmark(&bench_options);
+        } else if (strcmp(bench, "reload") == 0) {
+            run_reload_benchmark(&bench_options, threads);
+        } else if (strcmp(bench, "parallel") == 0) {
+            run_parallel_benchmark(&bench_options, threads);
+        } else if (strcmp(bench, "cache") == 0) {
+            run_cache_benchmark(&bench_options, threads);
+        } else {
+            fprintf(stderr, "Error: Unknown benchmark '%s'\n", bench);
+            return 1;
+        }
+        return 0;
+    }
+
+    // Initialize grammar: a compiled grammar file is mapped as is; otherwise
+    // the grammar comes from a grammar file or is the built-in one, and FIRST,
+    // FOLLOW and the parsing table are computed
+    Grammar grammar;
+    grammar_init(&grammar);
+    if (grammar_path && is_compiled_grammar_file(grammar_path)) {
+        if (!map_grammar(&grammar, grammar_path)) return 1;
+    } else {
+        if (grammar_path) {
+            if (!load_grammar(&grammar, grammar_path)) return 1;
+        } else {
+            add_expression_grammar(&grammar);
+        }
+        if (!compile_grammar(&grammar) && !check_ll1(&grammar, grammar_path ? grammar_path : "built-in grammar")) {
+            free_grammar(&grammar);
+            return 1;
+        }
+    }
+
+    if (compile_path) {
+        bool saved = save_grammar(&grammar, compile_path);
+        if (saved) {
+            printf("Compiled %d rules, %d non-terminals, %d terminals into '%s'\n",
+                   grammar.rule_count, grammar.non_terminals.count, grammar.terminals.count, compile_path);
+        }
+        free_grammar(&grammar);
+        return saved ? 0 : 1;
+    }
+
+    if (generate_path) {
+        FILE *out = fopen(generate_path, "w");
+        if (!out) {
+            fprintf(stderr, "Error: Cannot write generated parser '%s'\n", generate_path);
+            free_grammar(&grammar);
+            return 1;
+        }
+        bool generated = generate_parser(&grammar, out, parser_name);
+        generated &= fclose(out) == 0;
+        if (generated) {
+            printf("Generated %s_parse for %d rules into '%s'\n", parser_name, grammar.rule_count, generate_path);
+        }
+        free_grammar(&grammar);
+        return generated ? 0 : 1;
+    }
+
+    if (batch_path) {
+        int status = run_batch(&grammar, batch_path, threads, bitmap_path);
+        if (profile_path && !write_profile(&grammar, profile_path)) status = 1;
+        free_grammar(&grammar);
+        return status;
+    }
+
+    if (parallel_path) {
+        int status = run_parallel_parse(&grammar, parallel_path, threads);
+        free_grammar(&grammar);
+        return status;
+    }
+
+    if (watch) return run_watch(&grammar, grammar_path, cache_kib ? result_cache_create(cache_kib << 10, 0) : NULL);
+
+    ParseContext ctx;
+    parse_context_init(&ctx, &grammar);
+    TraceLog trace;
+    trace_init(&trace, TRACE_CAPACITY);
+    TraceLog *trace_log = trace_level == TRACE_OFF ? NULL : &trace;
+    ParseTree tree;
+    parse_tree_init(&tree);
+    bool accepted;
+    EvalStatus status = EVAL_OK;
+    int64_t value = 0;
+    char *input = NULL;
+
+    if (streaming) {
+        // Parse all of stdin (or the file) as one input, a chunk at a time
+        FILE *file = stream_path ? fopen(stream_path, "rb") : stdin;
+        if (!file) {
+            fprintf(stderr, "Error: Cannot open input file '%s'\n", stream_path);
+            return 1;
+        }
+        InputStream in;
+        stream_open_file(&in, file);
+        if (evaluate) {
+            status = evaluate_stream(&ctx, &in, trace_log, &value);
+            accepted = status == EVAL_OK;
+        } else {
+            accepted = parse_stream_tree(&ctx, &in, trace_log, build_tree ? &tree : NULL);
+        }
+        uint64_t stopped_at = stream_offset(&in);
+        stream_close(&in);
+        if (file != stdin) fclose(file);
+
+        if (trace_level == TRACE_TABLE) render_trace(&grammar, &trace, NULL);
+        if (evaluate && accepted) {
+            printf("\nValue = %lld\n", (long long)value);
+        } else if (evaluate && status != EVAL_REJECTED) {
+            printf("\nInput cannot be evaluated: %s (at offset %llu)\n",
+                   eval_status_message(status), (unsigned long long)stopped_at);
+        } else if (accepted) {
+            printf("\nInput is ACCEPTED by the grammar\n");
+        } else {
+            printf("\nInput is REJECTED by the grammar (at offset %llu)\n", (unsigned long long)stopped_at);
+        }
+    } else {
+        // Print the computed sets and the parsing table
+        print_first_follow(&grammar);
+        print_parsing_table(&grammar);
+
+        // Get input from user (one line, any length)
+        size_t input_size = 0;
+        printf("\nEnter input string to parse: ");
+        ssize_t length = getline(&input, &input_size, stdin);
+        if (length <= 0) return 1;
+        input[strcspn(input, "\r\n")] = '\0';
+
+        // Parse the input
+        if (evaluate) {
+            status = evaluate_input(&ctx, input, trace_log, &value);
+            accepted = status == EVAL_OK;
+        } else if (use_lexer) {
+            TokenBuffer tokens;
+            token_buffer_init(&tokens);
+            accepted = lex_input(&grammar, input, strlen(input), &tokens) && parse_tokens(&ctx, &tokens, trace_log);
+            token_buffer_free(&tokens);
+        } else {
+            accepted = parse_input_tree(&ctx, input, trace_log, build_tree ? &tree : NULL);
+        }
+        if (trace_level == TRACE_TABLE) render_trace(&grammar, &trace, input);
+    }
+
+    if (trace_level == TRACE_BINARY) {
+        printf("\nTrace: %llu events recorded (%u-event ring buffer, %zu bytes each)\n",
+               (unsigned long long)trace.count, trace.capacity, sizeof(TraceEvent));
+    }
+    trace_free(&trace);
+
+    if (build_tree) {
+        printf("\nParse tree (%d nodes):\n", tree.count);
+        write_parse_tree(&grammar, &tree, stdout);
+    }
+    parse_tree_free(&tree);
+
+    if (!streaming) {
+        if (evaluate && accepted) {
+            printf("\nInput '%s' = %lld\n", input, (long long)value);
+        } else if (evaluate && status != EVAL_REJECTED) {
+            printf("\nInput '%s' cannot be evaluated: %s\n", input, eval_status_message(status));
+        } else if (accepted) {
+            printf("\nInput '%s' is ACCEPTED by the grammar\n", input);
+        } else {
+            printf("\nInput '%s' is REJECTED by the grammar\n", input);
+        }
+    }
+
+    free(input);
+    parse_context_free(&ctx);
+    int exit_status = accepted ? 0 : 2;
+    if (profile_path && !write_profile(&grammar, profile_path)) exit_status = 1;
+    free_grammar(&grammar);
+    return exit_status;
+}
+
+#endif // LL1_NO_MAIN
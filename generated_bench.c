@@ -0,0 +1,123 @@
+// Benchmark of a generated parser against the table-driven parse_input, on the
+// built-in expression grammar. Build the generated parser first:
+//
+//     ./ll1 --generate=expression_parser.c --name=expression
+//     gcc -O2 -DLL1_NO_MAIN -o generated_bench generated_bench.c expression_parser.c "LL(1) predictive parser.c" -pthread
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ll1_parser.h"
+
+bool expression_parse(const char *input);
+
+#define INPUT_COUNT 100000
+#define REPEATS 5
+
+// Small deterministic PRNG (xorshift32)
+static uint32_t rng_state = 2463534242u;
+
+static uint32_t next_rand() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Function to append one character, keeping the buffer NUL-terminated
+static void append_char(char **buf, size_t *length, size_t *capacity, char c) {
+    if (*length + 2 > *capacity) {
+        *capacity *= 2;
+        *buf = realloc(*buf, *capacity);
+    }
+    (*buf)[(*length)++] = c;
+    (*buf)[*length] = '\0';
+}
+
+// Function to append a random expression of at most `depth` nesting levels
+static void append_expression(char **buf, size_t *length, size_t *capacity, int depth) {
+    int terms = 1 + next_rand() % 4;
+    for (int i = 0; i < terms; i++) {
+        if (i > 0) append_char(buf, length, capacity, next_rand() % 2 ? '+' : '*');
+        if (depth > 0 && next_rand() % 4 == 0) {
+            append_char(buf, length, capacity, '(');
+            append_expression(buf, length, capacity, depth - 1);
+            append_char(buf, length, capacity, ')');
+        } else {
+            append_char(buf, length, capacity, 'i');
+        }
+    }
+}
+
+// Function to build the inputs: random expressions, one in five with a
+// character replaced so that both accepting and rejecting paths are timed
+static char **generate_inputs(int count, size_t *total_bytes) {
+    static const char alphabet[] = "i()*+";
+    char **inputs = malloc(count * sizeof(char *));
+    *total_bytes = 0;
+    for (int n = 0; n < count; n++) {
+        size_t length = 0, capacity = 64;
+        char *buf = malloc(capacity);
+        append_expression(&buf, &length, &capacity, 6);
+        if (next_rand() % 5 == 0) buf[next_rand() % length] = alphabet[next_rand() % 5];
+        inputs[n] = buf;
+        *total_bytes += length;
+    }
+    return inputs;
+}
+
+int main() {
+    Grammar grammar;
+    grammar_init(&grammar);
+    add_expression_grammar(&grammar);
+    compile_grammar(&grammar);
+
+    size_t total_bytes;
+    char **inputs = generate_inputs(INPUT_COUNT, &total_bytes);
+    bool *table_results = malloc(INPUT_COUNT * sizeof(bool));
+    bool *generated_results = malloc(INPUT_COUNT * sizeof(bool));
+
+    ParseContext ctx;
+    parse_context_init(&ctx, &grammar);
+    double start = now_seconds();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int n = 0; n < INPUT_COUNT; n++) table_results[n] = parse_input(&ctx, inputs[n], NULL);
+    }
+    double table_time = (now_seconds() - start) / REPEATS;
+
+    start = now_seconds();
+    for (int r = 0; r < REPEATS; r++) {
+        for (int n = 0; n < INPUT_COUNT; n++) generated_results[n] = expression_parse(inputs[n]);
+    }
+    double generated_time = (now_seconds() - start) / REPEATS;
+
+    int accepted = 0, mismatches = 0;
+    for (int n = 0; n < INPUT_COUNT; n++) {
+        accepted += table_results[n];
+        mismatches += table_results[n] != generated_results[n];
+    }
+
+    printf("%d inputs, %zu bytes, %d accepted\n", INPUT_COUNT, total_bytes, accepted);
+    printf("Table-driven parse_input: %8.2f ms (%6.1f MB/s)\n", table_time * 1e3, total_bytes / table_time / 1e6);
+    printf("Generated parser:         %8.2f ms (%6.1f MB/s)\n", generated_time * 1e3, total_bytes / generated_time / 1e6);
+    printf("Speedup: %.2fx, results %s\n", table_time / generated_time,
+           mismatches ? "DIFFER" : "identical");
+
+    for (int n = 0; n < INPUT_COUNT; n++) free(inputs[n]);
+    free(inputs);
+    free(table_results);
+    free(generated_results);
+    parse_context_free(&ctx);
+    free_grammar(&grammar);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,426 @@
+// LL(1) predictive parser library.
+//
+// A Grammar is built once (add_rule / load_grammar, then compile_grammar) and
+// is read-only afterwards, so any number of threads can parse with the same
+// Grammar at the same time. Each thread parses with its own ParseContext,
+// which owns the parse stack; contexts are cheap and can be reused.
+#ifndef LL1_PARSER_H
+#define LL1_PARSER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Grammar symbols are dense integer IDs. Terminals are 0 .. terminal_count-1 and
+// non-terminal n is stored as ~n, so a symbol is a terminal iff it is >= 0.
+typedef int32_t Symbol;
+#define NT_SYMBOL(n) ((Symbol)~(n))   // Symbol for non-terminal index n
+#define NT_INDEX(s) (~(s))            // Non-terminal index of a non-terminal symbol
+
+// Semantic actions. An action symbol in a right-hand side runs when the
+// evaluator pops it, on the value stack: binary actions replace the top two
+// values with the result, neg negates the top value. Action symbols lie above
+// every terminal ID and are only ever seen by the evaluator.
+enum {
+    ACTION_ADD,
+    ACTION_SUB,
+    ACTION_MUL,
+    ACTION_DIV,
+    ACTION_MOD,
+    ACTION_NEG,
+    ACTION_COUNT
+};
+#define ACTION_BASE 0x40000000
+#define ACTION_SYMBOL(a) ((Symbol)(ACTION_BASE + (a)))
+
+// Structure to represent a production rule. The right-hand side is a span of
+// rhs_arena stored in reverse, i.e. in the order it is pushed on the stack.
+// The evaluator pushes a second span that also holds the production's action
+// symbols; for a production without actions both spans are the same.
+typedef struct {
+    int lhs;                    // Left-hand side non-terminal index
+    int rhs_start;              // Offset of the reversed right-hand side in rhs_arena
+    int rhs_len;                // Number of symbols (0 for an ε-production)
+    int eval_start;             // Offset of the reversed right-hand side with actions
+    int eval_len;
+} ProductionRule;
+
+// Parsing table cells hold a production index, or NO_PRODUCTION for an error entry
+typedef uint16_t TableEntry;
+#define NO_PRODUCTION UINT16_MAX
+
+// Expansion chains: for each filled table cell (A, t), every production the
+// parser applies with lookahead t, starting from A, until a terminal is on top
+// or the symbols pushed by the chain are used up. A chain is a record in
+// chain_arena: the number of productions, the number of symbols it leaves on
+// the stack, the highest the stack rises above the non-terminal, then the
+// productions in order, then the symbols in push order.
+#define CHAIN_HEADER 3              // Counts before a chain's productions
+#define CHAIN_MAX_STEPS 16          // Longest chain; a longer expansion continues in the next chain
+#define CHAIN_NONE UINT32_MAX       // Chain index of an error entry
+
+// Structure to store FIRST and FOLLOW sets for non-terminals
+typedef struct {
+    uint64_t *first;            // FIRST set: bit i is set if terminal i is in it
+    bool first_epsilon;         // Whether epsilon is in the FIRST set
+    uint64_t *follow;           // FOLLOW set: bit i is set if terminal i is in it
+} FirstFollow;
+
+// Structure to intern symbol names into dense IDs (open-addressing hash index)
+typedef struct {
+    char **names;               // Name of every symbol, indexed by ID
+    int count;                  // Number of symbols
+    int capacity;               // Allocated length of names
+    int *slots;                 // Hash slots holding ID + 1 (0 means empty)
+    int slot_count;             // Number of slots (power of two)
+} SymbolTable;
+
+// Structure holding a grammar and everything computed from it
+typedef struct {
+    SymbolTable terminals;          // Terminal symbols
+    SymbolTable non_terminals;      // Non-terminal symbols
+    int terminal_of_byte[256];      // Input byte -> terminal ID, -1 if none
+    int start_symbol;               // Start non-terminal index
+    int end_marker;                 // Terminal ID of '$'
+    int literal_terminal;           // Terminal read for a run of digits, -1 if none
+    int conflict_lhs;               // First parsing table cell two productions claim, -1 if LL(1)
+    int conflict_terminal;
+
+    ProductionRule *rules;          // All production rules
+    int rule_count;
+    int rule_capacity;
+    Symbol *rhs_arena;              // Every right-hand side, reversed, back to back
+    int arena_count;
+    int arena_capacity;
+
+    int set_words;                  // 64-bit words per FIRST/FOLLOW set
+    FirstFollow *firstFollow;       // FIRST and FOLLOW sets, one per non-terminal
+    uint64_t *set_storage;          // Backing words of every FIRST/FOLLOW set
+
+    TableEntry *parsing_table;      // non-terminals x terminals production indices, NULL when packed
+    int32_t *row_base;              // Packed table: where each non-terminal's row starts, NULL when dense
+    uint32_t *packed_cells;         // Packed table: (non-terminal + 1) << 16 | production, 0 if free
+    int packed_count;
+    uint32_t *chain_index;          // Expansion chain of each table cell (or packed slot), CHAIN_NONE if none
+    int32_t *chain_arena;           // Expansion chain records, back to back
+    int chain_count;                // Used length of chain_arena
+    int chain_capacity;
+
+    void *mapping;                  // Compiled grammar file this grammar reads from, if any
+    size_t mapping_size;
+    uint64_t table_id;              // Unique per parsing table built or mapped, 0 before; keys result caches
+} Grammar;
+
+// Trace events: action is the production applied, or one of these codes
+enum {
+    TRACE_MATCH = -1,
+    TRACE_ACCEPT = -2,
+    TRACE_INVALID_SYMBOL = -3,
+    TRACE_MISMATCH = -4,
+    TRACE_NO_PRODUCTION = -5
+};
+
+// Structure for one parse step in the binary trace
+typedef struct {
+    uint32_t step;              // Step number within the parse
+    int32_t action;             // Production index or TRACE_* code
+    uint64_t input_offset;      // Input position when the step was taken
+} TraceEvent;
+
+// Preallocated ring buffer of trace events; the oldest are overwritten when full
+typedef struct {
+    TraceEvent *events;
+    uint32_t capacity;          // Number of slots (power of two)
+    uint64_t count;             // Number of events ever recorded
+} TraceLog;
+
+// How much parse_input records: nothing, the binary log, or the binary log
+// rendered afterwards as the Stack/Input/Action table
+typedef enum {
+    TRACE_OFF,
+    TRACE_BINARY,
+    TRACE_TABLE
+} TraceLevel;
+
+#define TRACE_CAPACITY 4096     // Default number of events kept by the ring buffer
+
+// Structure for reading input in fixed-size chunks from a file, or straight
+// from an in-memory string. Offsets count bytes from the start of the input.
+typedef struct {
+    FILE *file;                 // Source file, or NULL for a string
+    char *buffer;               // Current chunk (the string itself for a string)
+    size_t length;              // Bytes in the current chunk
+    size_t pos;                 // Read position within the chunk
+    uint64_t base;              // Input offset of buffer[0]
+} InputStream;
+
+// Tokens of a lexed input, as two parallel arrays
+typedef struct {
+    Symbol *terminals;          // Terminal ID of each token (-1 for an invalid byte), ending with '$'
+    uint32_t *offsets;          // Source offset of each token
+    int count;
+    int capacity;
+} TokenBuffer;
+
+// Result of validating newline-separated inputs with validate_lines
+typedef struct {
+    uint64_t line_count;        // Number of lines seen
+    uint64_t *failed_lines;     // 1-based numbers of rejected lines, ascending
+    uint64_t failed_count;
+} BatchResult;
+
+// Result of parsing one input with parse_parallel
+typedef struct {
+    bool accepted;
+    uint64_t stop_offset;       // Where parsing stopped, as stream_offset after parse_stream
+    int segments;               // Segments parsed concurrently
+    int reparsed;               // Segments parsed again because their guessed start stack was wrong
+} ParallelResult;
+
+// Counters of a result cache, summed over its shards
+typedef struct {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t entries;           // Entries held now
+    uint64_t bytes;             // Bytes held now, counted against the capacity
+} CacheStats;
+
+// Node of a parse tree. The children of a node are contiguous in the tree's
+// node array, in grammar order, so they are an index range, not pointers.
+typedef struct {
+    Symbol symbol;              // Terminal or non-terminal
+    int32_t production;         // Production applied, or -1 for a terminal or an unexpanded non-terminal
+    uint32_t first_child;       // Index of the first child
+    uint32_t child_count;       // Number of children (the production's length)
+    uint64_t input_offset;      // Input position where the node's text starts
+} ParseNode;
+
+// Parse tree built by parse_stream_tree. Nodes come from one growable array
+// that is reused, not freed, between parses; the root is node 0.
+typedef struct {
+    ParseNode *nodes;
+    int count;
+    int capacity;
+} ParseTree;
+
+// Per-parse state. One context per thread; the grammar is only read.
+typedef struct {
+    const Grammar *grammar;
+    Symbol *stack;              // Parse stack, grown on demand
+    int stack_capacity;
+    int top;
+    uint32_t *node_stack;       // Tree node of each stacked symbol, when building a tree
+    int node_capacity;
+    int64_t *values;            // Value stack, when evaluating
+    int value_capacity;
+    int value_count;
+} ParseContext;
+
+// Incremental parse checkpoint: the parse stack at a token boundary
+typedef struct {
+    uint64_t offset;            // Input offset; counted back from the end of the input after the gap
+    int stack_start;            // Offset of the stack, bottom first, in snapshots
+    int depth;                  // Number of stacked symbols
+} Checkpoint;
+
+// State kept between incremental parses of one input as it is edited. The
+// checkpoints are a gap buffer kept open at the last edit: the ones before the
+// gap count their offsets from the start of the input and the ones after it
+// from the end, so an edit only touches the checkpoints between it and the
+// previous edit.
+typedef struct {
+    ParseContext ctx;
+    Checkpoint *checkpoints;    // [0, before) before the gap, [capacity - after, capacity) after it
+    int checkpoint_capacity;
+    int before;
+    int after;
+    Symbol *snapshots;          // Stacks of the checkpoints, back to back
+    int snapshot_count;
+    int snapshot_capacity;
+    int snapshot_garbage;       // Symbols of dropped checkpoints still in snapshots
+    uint64_t length;            // Length of the input last parsed
+    bool accepted;              // Result of the last parse
+    uint64_t stop_from_end;     // Where the last parse stopped, counted back from the end
+    bool resynced;              // Whether the last parse stopped at a matching checkpoint
+    uint64_t scanned;           // Input bytes read by the last parse
+} IncrementalParse;
+
+// Outcome of evaluating an input
+typedef enum {
+    EVAL_OK,
+    EVAL_REJECTED,              // The input is not in the language
+    EVAL_NO_VALUE,              // A literal without digits, or an action short of operands
+    EVAL_OUT_OF_RANGE,          // A literal does not fit in int64_t
+    EVAL_DIVIDE_BY_ZERO
+} EvalStatus;
+
+// Building a grammar
+void grammar_init(Grammar *g);
+void free_grammar(Grammar *g);
+int add_terminal(Grammar *g, const char *name);
+int add_non_terminal(Grammar *g, const char *name);
+bool add_rule_symbols(Grammar *g, int lhs, const Symbol *rhs, int rhs_len);
+void set_literal_terminal(Grammar *g, int terminal);
+void add_rule(Grammar *g, char lhs, const char *rhs);
+bool load_grammar(Grammar *g, const char *path);
+void add_expression_grammar(Grammar *g);
+
+// Compiling it: finish_grammar, compute_first, compute_follow and
+// create_parsing_table in order, or compile_grammar to run all four.
+// Large, sparse parsing tables are packed by row displacement; read cells
+// with table_entry, which works for both layouts. create_parsing_table also
+// precomputes the expansion chain of every cell. Both return false if the
+// grammar is not LL(1); the first conflicting cell is kept in the grammar.
+// FIRST and FOLLOW are solved one strongly connected component of the
+// non-terminal dependency graph at a time, independent components in
+// parallel; the _threads variants cap the threads (0 = one per online CPU).
+void finish_grammar(Grammar *g);
+void compute_first(Grammar *g);
+void compute_follow(Grammar *g);
+void compute_first_threads(Grammar *g, int threads);
+void compute_follow_threads(Grammar *g, int threads);
+bool create_parsing_table(Grammar *g);
+bool compile_grammar(Grammar *g);
+
+// Compiled grammar files: save_grammar writes a compiled grammar (symbols,
+// productions, FIRST/FOLLOW sets, parsing table and expansion chains) and
+// map_grammar maps one read-only, ready to parse with. A mapped grammar cannot be extended.
+bool save_grammar(const Grammar *g, const char *path);
+bool map_grammar(Grammar *g, const char *path);
+bool is_compiled_grammar_file(const char *path);
+
+// Code generation: write standalone C source for a parser specialized to one
+// compiled grammar, exposing bool <name>_parse(const char *input)
+bool generate_parser(const Grammar *g, FILE *out, const char *name);
+
+// Inspecting it
+const char *symbol_name(const Grammar *g, Symbol s);
+int get_terminal_index(const Grammar *g, char c);
+int get_non_terminal_index(const Grammar *g, const char *name);
+const Symbol *rule_rhs(const Grammar *g, const ProductionRule *rule);
+TableEntry table_entry(const Grammar *g, int nt, int t);
+bool set_contains(const uint64_t *set, int term_index);
+void format_production(const Grammar *g, const ProductionRule *rule, char *buf, size_t size);
+void print_first_follow(const Grammar *g);
+void print_parsing_table(const Grammar *g);
+
+// Input streams
+void stream_open_string(InputStream *in, const char *text);
+void stream_open_file(InputStream *in, FILE *file);
+void stream_open_buffer(InputStream *in, const char *data, size_t length);
+void stream_close(InputStream *in);
+uint64_t stream_offset(const InputStream *in);
+
+// Tracing
+void trace_init(TraceLog *log, uint32_t capacity);
+void trace_free(TraceLog *log);
+void render_trace(const Grammar *g, const TraceLog *log, const char *input);
+
+// Parsing
+void parse_context_init(ParseContext *ctx, const Grammar *g);
+void parse_context_free(ParseContext *ctx);
+bool parse_stream(ParseContext *ctx, InputStream *in, TraceLog *trace);
+bool parse_input(ParseContext *ctx, const char *input, TraceLog *trace);
+
+// Lexing: classify a whole input into tokens in bulk (SIMD where available),
+// then parse the tokens. Words (identifiers and numbers) are single literal
+// tokens when the grammar has a literal terminal.
+void token_buffer_init(TokenBuffer *tokens);
+void token_buffer_free(TokenBuffer *tokens);
+bool lex_input(const Grammar *g, const char *data, size_t length, TokenBuffer *tokens);
+bool parse_tokens(ParseContext *ctx, const TokenBuffer *tokens, TraceLog *trace);
+
+// Incremental parsing: incremental_parse parses a whole input and records
+// checkpoints; after an edit replaced old bytes [edit_start, old_end) with
+// new bytes [edit_start, new_end), incremental_reparse takes the whole edited
+// input, resumes from the last checkpoint before the edit and stops as soon as
+// the parse reaches a checkpoint after the edit with the same stack. Either
+// returns whether the input is accepted; incremental_stop_offset gives where
+// the parse stopped (the end of the input, or the offending character).
+void incremental_init(IncrementalParse *inc, const Grammar *g);
+void incremental_free(IncrementalParse *inc);
+bool incremental_parse(IncrementalParse *inc, const char *text, size_t length);
+bool incremental_reparse(IncrementalParse *inc, const char *text, size_t length,
+                         size_t edit_start, size_t old_end, size_t new_end);
+uint64_t incremental_stop_offset(const IncrementalParse *inc);
+
+// Parse trees: as above, also building the derivation into `tree`. On
+// rejection the tree holds the derivation up to the point of failure.
+void parse_tree_init(ParseTree *tree);
+void parse_tree_free(ParseTree *tree);
+bool parse_stream_tree(ParseContext *ctx, InputStream *in, TraceLog *trace, ParseTree *tree);
+bool parse_input_tree(ParseContext *ctx, const char *input, TraceLog *trace, ParseTree *tree);
+void write_parse_tree(const Grammar *g, const ParseTree *tree, FILE *out);
+
+// Evaluation: parse and run the grammar's semantic actions in the same pass.
+// Each literal pushes its value and the value left on top is the result.
+// Arithmetic wraps around on overflow.
+EvalStatus evaluate_stream(ParseContext *ctx, InputStream *in, TraceLog *trace, int64_t *result);
+EvalStatus evaluate_input(ParseContext *ctx, const char *input, TraceLog *trace, int64_t *result);
+const char *eval_status_message(EvalStatus status);
+
+// Profiling, when the library is built with -DLL1_PROFILE: every parse counts
+// the parsing table cells it expands, the terminals it matches, its steps and
+// its stack depth, and compute_first, compute_follow and create_parsing_table
+// record their wall time. Counters are kept per thread and per grammar and
+// merged by profile_write_json, which writes them as JSON; call it while no
+// thread is parsing with the grammar. Without LL1_PROFILE nothing is counted
+// and profile_write_json returns false.
+void profile_reset(void);
+bool profile_write_json(const Grammar *g, FILE *out);
+
+// Hot reloading: a SharedGrammar holds the current compiled grammar behind
+// one atomic pointer. Publishing a new grammar (shared_grammar_publish, or
+// shared_grammar_reload from a file, typically on a background thread) swaps
+// the pointer; parses already running finish on the grammar they acquired,
+// which is freed once the last of them releases it (epoch-based
+// reclamation). Readers take no locks: acquire and release are a few atomic
+// loads and stores. Read sections may nest; parse between acquire and release
+// with ctx->grammar set to the acquired grammar, or use shared_parse_input.
+typedef struct SharedGrammar SharedGrammar;
+SharedGrammar *shared_grammar_create(Grammar *g);
+void shared_grammar_free(SharedGrammar *shared);
+void shared_grammar_publish(SharedGrammar *shared, Grammar *g);
+bool shared_grammar_reload(SharedGrammar *shared, const char *path);
+int shared_grammar_reclaim(SharedGrammar *shared);
+uint64_t shared_grammar_version(SharedGrammar *shared);
+const Grammar *shared_grammar_acquire(SharedGrammar *shared);
+void shared_grammar_release(SharedGrammar *shared);
+bool shared_parse_input(SharedGrammar *shared, ParseContext *ctx, const char *input, TraceLog *trace);
+
+// Result cache: a bounded memo of parse results in front of parse_input,
+// evaluate_input and parse_input_tree, for traffic that repeats inputs. It is
+// keyed by the input bytes and the grammar's table_id, so grammars can be
+// swapped under it. Shards have their own locks and CLOCK eviction; all
+// functions are thread-safe, and each thread parses with its own context.
+typedef struct ResultCache ResultCache;
+ResultCache *result_cache_create(size_t capacity, int shard_count);
+void result_cache_free(ResultCache *cache);
+void result_cache_clear(ResultCache *cache);
+void result_cache_stats(ResultCache *cache, CacheStats *stats);
+bool cached_parse_input(ResultCache *cache, ParseContext *ctx, const char *input);
+EvalStatus cached_evaluate_input(ResultCache *cache, ParseContext *ctx, const char *input, int64_t *value);
+bool cached_parse_input_tree(ResultCache *cache, ParseContext *ctx, const char *input, ParseTree *tree);
+
+// Batch validation: parse every line of `data` as a separate input on
+// `threads` worker threads (0 = one per online CPU), reading `data` in place
+void validate_lines(const Grammar *g, const char *data, size_t length, int threads, BatchResult *result);
+void batch_result_free(BatchResult *result);
+
+// Parallel parsing: parse one long input on `threads` threads (0 = one per
+// online CPU), split at operators outside parentheses. The result is always
+// that of parse_stream; `result` may be NULL.
+bool parse_parallel(const Grammar *g, const char *data, size_t length, int threads, ParallelResult *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LL1_PARSER_H